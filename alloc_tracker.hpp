@@ -0,0 +1,323 @@
+/*
+ * Allocation Tracker
+ * By:  Matthew Evans
+ * File:  alloc_tracker.hpp
+ * Version:  101826
+ *
+ * See LICENSE.md for copyright information.
+ *
+ * Count heap allocations, bytes and peak live bytes per thread.
+ * Counting needs allocation hooks compiled into exactly one source file.
+ * Define one of these before including this header in that file:
+ *
+ *   WTF_ALLOC_TRACKER_IMPLEMENT     Replace global operator new / delete,
+ *                                   including the aligned overloads.
+ *   WTF_ALLOC_TRACKER_HOOK_MALLOC   Replace malloc, calloc, realloc, free and
+ *                                   the aligned allocators (posix_memalign,
+ *                                   aligned_alloc, memalign, valloc).
+ *                                   Also sees C allocations.  glibc only.
+ *
+ * Without either, the tracker reports as not linked and counts nothing.
+ * Sizes come from malloc_usable_size, so Linux is required.
+ *
+ * Example:
+ *
+ * #define WTF_ALLOC_TRACKER_IMPLEMENT
+ * #include <libwtf/alloc_tracker.hpp>
+ *
+ * wtf::alloc_region region;
+ * region.begin();
+ *   ~~~ do something ~~~
+ * wtf::alloc_stats stats = region.end();
+ *
+ */
+
+#ifndef WTF_ALLOC_TRACKER_HPP
+#define WTF_ALLOC_TRACKER_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+#if defined(__linux__)
+#include <malloc.h>
+#endif
+
+#if defined(__GNUC__)
+#define WTF_ALLOC_TRACKER_TLS __attribute__((tls_model("initial-exec")))
+#else
+#define WTF_ALLOC_TRACKER_TLS
+#endif
+
+namespace wtf {
+
+/*!
+ * \struct alloc_stats
+ * \brief Allocation counts for a thread or a region.
+ */
+struct alloc_stats {
+    std::uint64_t allocations = 0;    //!<  Number of allocations.
+    std::uint64_t deallocations = 0;  //!<  Number of frees.
+    std::uint64_t bytes = 0;          //!<  Bytes allocated.
+    std::uint64_t bytes_freed = 0;    //!<  Bytes freed.
+    std::int64_t live = 0;            //!<  Bytes allocated and not yet freed.
+    std::int64_t peak = 0;            //!<  Highest live byte count.
+};
+
+namespace detail {
+
+//  Counters for the calling thread.  Plain data so no allocation is needed to create them.
+inline thread_local alloc_stats thread_alloc_stats WTF_ALLOC_TRACKER_TLS;
+//  Set when the allocation hooks are compiled in.
+inline bool alloc_hooks_linked = false;
+
+inline void count_alloc(void* ptr) noexcept {
+#if defined(__linux__)
+    if(ptr == nullptr) return;
+    const std::size_t size = malloc_usable_size(ptr);
+    alloc_stats& s = thread_alloc_stats;
+    s.allocations++;
+    s.bytes += size;
+    s.live += static_cast<std::int64_t>(size);
+    if(s.live > s.peak) s.peak = s.live;
+#else
+    (void)ptr;
+#endif
+};
+
+inline void count_free(void* ptr) noexcept {
+#if defined(__linux__)
+    if(ptr == nullptr) return;
+    const std::size_t size = malloc_usable_size(ptr);
+    alloc_stats& s = thread_alloc_stats;
+    s.deallocations++;
+    s.bytes_freed += size;
+    //  Memory allocated on another thread lowers this thread's live count.
+    s.live -= static_cast<std::int64_t>(size);
+#else
+    (void)ptr;
+#endif
+};
+
+}  //  end namespace detail
+
+/*!
+ * \class alloc_tracker
+ * \brief Read allocation counters.
+ */
+class alloc_tracker {
+    public:
+        /*!
+         * \brief Check if the allocation hooks are compiled in.
+         * \return True if allocations are being counted.
+         */
+        static bool linked(void) { return detail::alloc_hooks_linked; };
+
+        /*!
+         * \brief Get the counters for the calling thread.
+         * \return Totals since the thread started.
+         */
+        static alloc_stats thread_stats(void) { return detail::thread_alloc_stats; };
+};
+
+/*!
+ * \class alloc_region
+ * \brief Measure allocations made by the calling thread between begin() and end().
+ * Regions may be nested.
+ */
+class alloc_region {
+    public:
+        /*!
+         * \brief Start counting.
+         */
+        void begin(void) {
+            alloc_stats& s = detail::thread_alloc_stats;
+            start = s;
+            //  Restart the peak from the current live count, end() restores the outer peak.
+            s.peak = s.live;
+        };
+
+        /*!
+         * \brief Stop counting.
+         * \return Allocations made since begin().  Peak is relative to the live
+         *         count at begin().
+         */
+        alloc_stats end(void) {
+            alloc_stats& s = detail::thread_alloc_stats;
+            alloc_stats res;
+            res.allocations = s.allocations - start.allocations;
+            res.deallocations = s.deallocations - start.deallocations;
+            res.bytes = s.bytes - start.bytes;
+            res.bytes_freed = s.bytes_freed - start.bytes_freed;
+            res.live = s.live - start.live;
+            res.peak = s.peak - start.live;
+            if(start.peak > s.peak) s.peak = start.peak;
+            return res;
+        };
+
+    private:
+        alloc_stats start;  //  Thread counters at begin()
+};
+
+}  //  end namespace wtf
+
+#endif
+
+//  Hooks are outside the include guard so they are defined even if the
+//  header was already included without them, eg by benchmark.hpp.
+#if !defined(WTF_ALLOC_TRACKER_HOOKS_DEFINED) && \
+    (defined(WTF_ALLOC_TRACKER_HOOK_MALLOC) || defined(WTF_ALLOC_TRACKER_IMPLEMENT))
+#define WTF_ALLOC_TRACKER_HOOKS_DEFINED
+
+#if defined(WTF_ALLOC_TRACKER_HOOK_MALLOC) && defined(__GLIBC__)
+
+#include <cerrno>
+
+extern "C" {
+void* __libc_malloc(std::size_t);
+void* __libc_calloc(std::size_t, std::size_t);
+void* __libc_realloc(void*, std::size_t);
+void* __libc_memalign(std::size_t, std::size_t);
+void* __libc_valloc(std::size_t);
+void* __libc_pvalloc(std::size_t);
+void __libc_free(void*);
+
+void* malloc(std::size_t size) {
+    void* ptr = __libc_malloc(size);
+    wtf::detail::count_alloc(ptr);
+    return ptr;
+}
+
+void* calloc(std::size_t count, std::size_t size) {
+    void* ptr = __libc_calloc(count, size);
+    wtf::detail::count_alloc(ptr);
+    return ptr;
+}
+
+void* realloc(void* old_ptr, std::size_t size) {
+    wtf::detail::count_free(old_ptr);
+    void* ptr = __libc_realloc(old_ptr, size);
+    //  On failure the old block is still allocated.
+    wtf::detail::count_alloc(ptr == nullptr && size != 0 ? old_ptr : ptr);
+    return ptr;
+}
+
+void free(void* ptr) {
+    wtf::detail::count_free(ptr);
+    __libc_free(ptr);
+}
+
+//  Aligned allocators are freed with free(), so they must be counted too.
+void* memalign(std::size_t alignment, std::size_t size) {
+    void* ptr = __libc_memalign(alignment, size);
+    wtf::detail::count_alloc(ptr);
+    return ptr;
+}
+
+void* aligned_alloc(std::size_t alignment, std::size_t size) { return memalign(alignment, size); }
+
+int posix_memalign(void** out, std::size_t alignment, std::size_t size) {
+    if(alignment % sizeof(void*) != 0 || (alignment & (alignment - 1)) != 0) return EINVAL;
+    void* ptr = memalign(alignment, size);
+    if(ptr == nullptr) return ENOMEM;
+    *out = ptr;
+    return 0;
+}
+
+void* valloc(std::size_t size) {
+    void* ptr = __libc_valloc(size);
+    wtf::detail::count_alloc(ptr);
+    return ptr;
+}
+
+void* pvalloc(std::size_t size) {
+    void* ptr = __libc_pvalloc(size);
+    wtf::detail::count_alloc(ptr);
+    return ptr;
+}
+}
+
+static const bool wtf_alloc_hooks_registered = (wtf::detail::alloc_hooks_linked = true);
+
+#elif defined(WTF_ALLOC_TRACKER_IMPLEMENT) && defined(__linux__)
+
+namespace wtf {
+namespace detail {
+
+//  Allocate for operator new, calling the new handler until it succeeds or there is none.
+inline void* new_alloc(std::size_t size, const std::size_t& alignment) {
+    if(size == 0) size = 1;
+    for(;;) {
+        void* ptr = nullptr;
+        if(alignment <= alignof(std::max_align_t)) ptr = std::malloc(size);
+        else if(posix_memalign(&ptr, alignment < sizeof(void*) ? sizeof(void*) : alignment, size) != 0) ptr = nullptr;
+        if(ptr != nullptr) {
+            count_alloc(ptr);
+            return ptr;
+        }
+        const std::new_handler handler = std::get_new_handler();
+        if(handler == nullptr) throw std::bad_alloc();
+        handler();
+    }
+};
+
+inline void delete_free(void* ptr) noexcept {
+    count_free(ptr);
+    std::free(ptr);
+};
+
+}  //  end namespace detail
+}  //  end namespace wtf
+
+void* operator new(std::size_t size) { return wtf::detail::new_alloc(size, 0); }
+void* operator new[](std::size_t size) { return wtf::detail::new_alloc(size, 0); }
+
+void* operator new(std::size_t size, std::align_val_t al) {
+    return wtf::detail::new_alloc(size, static_cast<std::size_t>(al));
+}
+
+void* operator new[](std::size_t size, std::align_val_t al) {
+    return wtf::detail::new_alloc(size, static_cast<std::size_t>(al));
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+    try {
+        return wtf::detail::new_alloc(size, 0);
+    } catch(...) {
+        return nullptr;
+    }
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t& nt) noexcept { return operator new(size, nt); }
+
+void* operator new(std::size_t size, std::align_val_t al, const std::nothrow_t&) noexcept {
+    try {
+        return wtf::detail::new_alloc(size, static_cast<std::size_t>(al));
+    } catch(...) {
+        return nullptr;
+    }
+}
+
+void* operator new[](std::size_t size, std::align_val_t al, const std::nothrow_t& nt) noexcept {
+    return operator new(size, al, nt);
+}
+
+void operator delete(void* ptr) noexcept { wtf::detail::delete_free(ptr); }
+void operator delete[](void* ptr) noexcept { wtf::detail::delete_free(ptr); }
+void operator delete(void* ptr, std::size_t) noexcept { wtf::detail::delete_free(ptr); }
+void operator delete[](void* ptr, std::size_t) noexcept { wtf::detail::delete_free(ptr); }
+void operator delete(void* ptr, const std::nothrow_t&) noexcept { wtf::detail::delete_free(ptr); }
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept { wtf::detail::delete_free(ptr); }
+void operator delete(void* ptr, std::align_val_t) noexcept { wtf::detail::delete_free(ptr); }
+void operator delete[](void* ptr, std::align_val_t) noexcept { wtf::detail::delete_free(ptr); }
+void operator delete(void* ptr, std::size_t, std::align_val_t) noexcept { wtf::detail::delete_free(ptr); }
+void operator delete[](void* ptr, std::size_t, std::align_val_t) noexcept { wtf::detail::delete_free(ptr); }
+void operator delete(void* ptr, std::align_val_t, const std::nothrow_t&) noexcept { wtf::detail::delete_free(ptr); }
+void operator delete[](void* ptr, std::align_val_t, const std::nothrow_t&) noexcept { wtf::detail::delete_free(ptr); }
+
+static const bool wtf_alloc_hooks_registered = (wtf::detail::alloc_hooks_linked = true);
+
+#endif
+
+#endif
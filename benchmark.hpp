@@ -2,15 +2,20 @@
  * Benchmarking Tool
  * By:  Matthew Evans
  * File:  benchmark.hpp
- * Version:  012322
+ * Version:  101826
  *
  * See LICENSE.md for copyright information.
  *
  * Run a benchmark, recording time elapsed to a log file.
- * Template is used to cast to a duration type for logging.
+ * Template is used to cast to a duration type for logging.  Any duration
+ * works, including floating point.  Use auto_unit to pick the unit for each
+ * record.  See benchmark_units.hpp.
  * See:  https://en.cppreference.com/w/cpp/chrono/duration
  * 
- * Log file:  \benchmark_log.txt
+ * Log file:  benchmark/log.txt
+ * Set WTF_BENCHMARK_FORMAT to json, csv or chrome for machine readable
+ * output, and WTF_BENCHMARK_LOG to change the log file.  Logging to
+ * stderr, memory or a callback is set up with benchmark_output::set_sink().
  * 
  * Example:
  * 
@@ -19,30 +24,159 @@
  *   ~~~ do something ~~~
  * my_bench.stop();
  * 
+ * For high frequency timing use record() in place of stop().  This skips
+ * the log and adds the elapsed time to the label's latency histogram.
+ * See latency_histogram.hpp for reporting percentiles.
+ * 
+ * Call use_perf_counters(true) to also log hardware counters for the region.
+ * Set the iteration count with set_iterations() to log misses per iteration.
+ * 
+ * Call track_allocations(true) to log heap allocations, bytes and peak live
+ * bytes for the region.  Needs the hooks from alloc_tracker.hpp linked in.
+ * 
+ * Call use_cpu_time(true) to log CPU time, time off the CPU, context switches
+ * and page faults for the region.  A region that is mostly off the CPU with
+ * many voluntary switches is waiting on I/O or locks, not computing.
+ * 
+ * Reading the clock adds a small fixed cost to every measurement.  Call
+ * subtract_timer_overhead(true) to remove the cost measured at startup,
+ * useful when timing operations of a few microseconds or less.  See
+ * timer_calibration.hpp.
+ * 
+ * Call set_bytes() or set_items() to log throughput, eg MB/s or items/s.
+ * Rates are scaled automatically and do not depend on the template unit.
+ * 
+ * Call use_sampling() to profile the region with the sampling profiler.
+ * Folded stacks rooted at the benchmark label are appended to
+ * benchmark/profile.folded for flame graph tools.
+ * 
+ * Phases of a benchmark can be timed with child spans or laps.  These are
+ * logged with the benchmark as a tree showing total and self time.
+ * 
+ * my_bench.start();
+ * {
+ *     auto span = my_bench.span("read");     //  Ends when it leaves scope
+ *       ~~~ read ~~~
+ * }
+ * my_bench.begin_span("process");
+ *   ~~~ parse ~~~
+ * my_bench.lap("parse");                     //  Child of "process"
+ *   ~~~ hash ~~~
+ * my_bench.lap("hash");
+ * my_bench.end_span();
+ * my_bench.stop();
+ * 
+ * Define WTF_BENCHMARK_DISABLE to compile all of this out, or call
+ * set_benchmark_enabled(false) to switch it off at run time.
+ * See benchmark_control.hpp.
+ * 
  */
 
 #ifndef WTF_BENCHMARK_HPP
 #define WTF_BENCHMARK_HPP
 
 #include <string>
-#include <fstream>
+#include <vector>
 #include <chrono>
-#include <mutex>
+#include <memory>
+#include <fstream>
+#include <filesystem>
+#include <stdexcept>
+#include <algorithm>
+#include <cstdint>
+
+#include "benchmark_control.hpp"
+#include "benchmark_units.hpp"
+
+#if defined(WTF_BENCHMARK_DISABLE)
+
+namespace wtf {
+
+/*!
+ * \class benchmark
+ * \brief Empty benchmark used when instrumentation is compiled out.
+ * Has the same interface as the full class.  Every call does nothing.
+ * \tparam T Unit, checked but otherwise unused.
+ */
+template <typename T = std::chrono::nanoseconds>
+class benchmark {
+    public:
+        static_assert(unit_traits<T>::valid, "Benchmark unit must be a std::chrono::duration or wtf::auto_unit.");
+
+        class scoped_span {
+            public:
+                ~scoped_span() {};  //  User provided so unused spans do not warn
+        };
+
+        //  Templated so no string is built from the label.
+        template <typename L>
+        explicit benchmark(const L&) {}
+
+        benchmark() = delete;
+
+        inline void start(void) {};
+        template <typename L> inline void begin_span(const L&) {}
+        inline void end_span(void) {};
+        template <typename L> inline scoped_span span(const L&) { return scoped_span(); }
+        template <typename L> inline void lap(const L&) {}
+        inline void use_perf_counters(const bool&) {};
+        template <typename... A> inline void use_sampling(const A&...) {}
+        inline void track_allocations(const bool&) {};
+        inline void use_cpu_time(const bool&) {};
+        inline void subtract_timer_overhead(const bool&) {};
+        inline void set_iterations(const std::uint64_t&) {};
+        inline void set_bytes(const std::uint64_t&) {};
+        inline void set_items(const std::uint64_t&) {};
+        inline void stop(void) {};
+        inline void record(void) {};
+        inline std::chrono::nanoseconds elapsed(void) const { return std::chrono::nanoseconds(0); };
+};
+
+}  //  end namespace wtf
+
+#else
+
+#include "latency_histogram.hpp"
+#include "perf_counters.hpp"
+#include "cpu_usage.hpp"
+#include "timer_calibration.hpp"
+#include "benchmark_output.hpp"
+#include "sampling_profiler.hpp"
 
 namespace wtf {
 
 /*!
  * \class benchmark
  * \brief Run a benchmark 
- * \tparam T See https://en.cppreference.com/w/cpp/chrono/duration
+ * \tparam T Log unit, a std::chrono::duration or auto_unit.  See benchmark_units.hpp.
  */
 template <typename T = std::chrono::nanoseconds>
 class benchmark {
     public:
         /*!
-         * \brief General initialization, see specializations below.
+         * \class scoped_span
+         * \brief Child span that ends when destroyed.  See span().
+         */
+        class scoped_span {
+            public:
+                scoped_span(benchmark& b, const std::string& name) : owner(b) { owner.begin_span(name); };
+                ~scoped_span() { owner.end_span(); };
+
+                scoped_span() = delete;
+                scoped_span(const scoped_span&) = delete;
+                scoped_span& operator=(const scoped_span&) = delete;
+
+            private:
+                benchmark& owner;
+        };
+
+        static_assert(unit_traits<T>::valid, "Benchmark unit must be a std::chrono::duration or wtf::auto_unit.");
+
+        /*!
+         * \brief Create a benchmark.
+         * \param label Benchmark label.
          */
-        benchmark(const std::string& label) : benchmark_label(label), time_label("nanoseconds") {};
+        benchmark(const std::string& label) : benchmark_label(label) {};
 
         benchmark() = delete;    //!<  Delete default constructor.
         ~benchmark() = default;  //!<  Default destructor.
@@ -50,90 +184,278 @@ class benchmark {
         /*!
          * \brief Start benchmark.
          */
-        void start(void) { start_bench = std::chrono::system_clock::now(); };
+        void start(void) {
+            active = benchmark_enabled();
+            if(!active) return;
+            spans.clear();
+            open_spans.clear();
+            if(sampler) {
+                sampler->clear();
+                sampler->start();
+            }
+            if(allocs_enabled) allocs.begin();
+            if(counters) counters->start();
+            if(cpu_enabled) cpu.start();
+            start_bench = std::chrono::system_clock::now();
+            end_bench = start_bench;
+            lap_mark = start_bench;
+        };
+
+        /*!
+         * \brief Start a child span under the innermost open span.
+         * \param name Span name.
+         */
+        void begin_span(const std::string& name) {
+            if(!active) return;
+            const auto now = std::chrono::system_clock::now();
+            spans.push_back({ name, open_spans.empty() ? no_parent : open_spans.back(),
+                              open_spans.size() + 1, now, now, now });
+            open_spans.push_back(spans.size() - 1);
+        };
+
+        /*!
+         * \brief End the innermost open span.
+         */
+        void end_span(void) {
+            if(!active || open_spans.empty()) return;
+            spans[open_spans.back()].end = std::chrono::system_clock::now();
+            open_spans.pop_back();
+        };
+
+        /*!
+         * \brief Start a child span that ends when the returned object is destroyed.
+         * \param name Span name.
+         * \return Scoped span object.
+         */
+        scoped_span span(const std::string& name) { return scoped_span(*this, name); };
+
+        /*!
+         * \brief Record a lap under the innermost open span.
+         * The lap covers the time since the previous lap, or since the span started.
+         * \param name Lap name.
+         */
+        void lap(const std::string& name) {
+            if(!active) return;
+            const auto now = std::chrono::system_clock::now();
+            const std::size_t parent = open_spans.empty() ? no_parent : open_spans.back();
+            const auto mark = (parent == no_parent) ? lap_mark : spans[parent].mark;
+            spans.push_back({ name, parent, open_spans.size() + 1, mark, now, now });
+            if(parent == no_parent) lap_mark = now;
+            else spans[parent].mark = now;
+        };
+
+        /*!
+         * \brief Enable or disable hardware counters.
+         * Counters measure the thread that calls this, so call it from the
+         * thread being benchmarked.  Falls back to timing only if unavailable.
+         * \param enable True to enable.
+         */
+        void use_perf_counters(const bool& enable) {
+            if(enable && !counters) counters = std::make_unique<perf_counters>();
+            if(!enable) counters.reset();
+        };
+
+        /*!
+         * \brief Enable or disable the sampling profiler.
+         * Samples the thread that calls start().  See sampling_profiler.hpp.
+         * \param hz Samples per second of CPU time, zero to disable.
+         * \param path File to append folded stacks to.
+         */
+        void use_sampling(const unsigned int& hz, const std::string& path = "benchmark/profile.folded") {
+            if(hz == 0) {
+                sampler.reset();
+                return;
+            }
+            sampler = std::make_unique<sampling_profiler>(hz);
+            profile_path = path;
+        };
+
+        /*!
+         * \brief Enable or disable allocation tracking for the measured region.
+         * Counts allocations made by the thread that calls start() and stop().
+         * \param enable True to enable.
+         */
+        void track_allocations(const bool& enable) { allocs_enabled = enable; };
+
+        /*!
+         * \brief Enable or disable CPU time and context switch accounting.
+         * Measures the thread that calls start() and stop().  See cpu_usage.hpp.
+         * \param enable True to enable.
+         */
+        void use_cpu_time(const bool& enable) { cpu_enabled = enable; };
+
+        /*!
+         * \brief Enable or disable removing the clock read cost from measurements.
+         * Applies to stop() and record().  Child spans are not adjusted.
+         * The first call runs the timer calibration if it has not run yet.
+         * \param enable True to enable.
+         */
+        void subtract_timer_overhead(const bool& enable) {
+            overhead = std::chrono::nanoseconds(enable ? timer_overhead_ns() : 0);
+        };
+
+        /*!
+         * \brief Set the number of iterations in the measured region.
+         * Used to log counters per iteration.
+         * \param count Iteration count.
+         */
+        void set_iterations(const std::uint64_t& count) { iterations = count; };
+
+        /*!
+         * \brief Set the number of bytes processed in the measured region.
+         * \param count Byte count, zero to stop reporting throughput.
+         */
+        void set_bytes(const std::uint64_t& count) { bytes = count; };
+
+        /*!
+         * \brief Set the number of items processed in the measured region.
+         * \param count Item count, zero to stop reporting the item rate.
+         */
+        void set_items(const std::uint64_t& count) { items = count; };
 
         /*!
          * \brief Stop benchmark and log to file.
-         * Logs all benchmarks to: benchmark\log.txt
+         * See benchmark_output.hpp for the log location and format.
          */
         void stop(void) {
-            end_bench = std::chrono::system_clock::now();
-            std::chrono::system_clock::duration total_time = end_bench - start_bench;
-            std::time_t start_time = std::chrono::system_clock::to_time_t(start_bench);
-            std::time_t end_time = std::chrono::system_clock::to_time_t(end_bench);
-
-            bench_mtx.lock();  //  Lock so multiple threads don't write at once.
-            std::ofstream benchmark_log;
-            benchmark_log.open("benchmark/log.txt", std::ios::app);
-            benchmark_log << "Benchmark:  " << benchmark_label << std::endl;
-            benchmark_log << "Started at:  " << std::ctime(&start_time);
-            benchmark_log << "Completed at:  " << std::ctime(&end_time);
-            if(total_time == std::chrono::system_clock::duration::zero()) {
-                benchmark_log << "Internal clock did not tick during benchmark";
-            } else {
-                benchmark_log << "Total time:  " <<
-                    std::chrono::duration_cast<T>(end_bench - start_bench).count() << 
-                    " " << time_label;
+            if(!active) return;
+            end_bench = std::max(start_bench, std::chrono::system_clock::now() - overhead);
+            benchmark_record rec;
+            if(cpu_enabled) {
+                rec.cpu = cpu.stop();
+                rec.has_cpu = true;
+            }
+            if(counters) {
+                rec.counters = counters->stop();
+                rec.has_counters = true;
+            }
+            if(allocs_enabled) {
+                rec.allocs = allocs.end();
+                rec.has_allocs = true;
+            }
+            if(sampler) write_profile();
+            rec.label = benchmark_label;
+            rec.start = start_bench;
+            rec.end = end_bench;
+            rec.elapsed_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end_bench - start_bench).count();
+            rec.elapsed = unit_traits<T>::count(rec.elapsed_ns, rec.elapsed_ns);
+            rec.unit = unit_traits<T>::label(rec.elapsed_ns);
+            rec.thread_id = benchmark_output::thread_id();
+            rec.iterations = iterations;
+            rec.bytes = bytes;
+            rec.items = items;
+            rec.name = benchmark_label;
+            rec.self_ns = rec.elapsed_ns;
+            rec.self = rec.elapsed;
+            if(overhead.count() > 0)
+                rec.metrics.push_back({ "timer_overhead_ns", static_cast<double>(overhead.count()) });
+            if(spans.empty()) {
+                benchmark_output::instance().write(rec);
+                return;
+            }
+
+            //  Close any spans left open, then build a record per span.
+            while(!open_spans.empty()) {
+                spans[open_spans.back()].end = end_bench;
+                open_spans.pop_back();
+            }
+            std::vector<benchmark_record> recs(spans.size() + 1);
+            recs[0] = rec;
+            for(std::size_t i = 0; i < spans.size(); i++) {
+                benchmark_record& child = recs[i + 1];
+                benchmark_record& parent = recs[spans[i].parent == no_parent ? 0 : spans[i].parent + 1];
+                child.label = parent.label + "/" + spans[i].name;
+                child.name = spans[i].name;
+                child.start = spans[i].start;
+                child.end = spans[i].end;
+                child.elapsed_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(child.end - child.start).count();
+                child.self_ns = child.elapsed_ns;
+                child.unit = unit_traits<T>::label(child.elapsed_ns);
+                child.thread_id = rec.thread_id;
+                child.depth = spans[i].depth;
+                child.span_id = static_cast<std::int64_t>(i + 1);
+                child.parent_id = parent.span_id;
+                parent.self_ns -= child.elapsed_ns;
+                parent.children++;
+            }
+            //  Self time uses the same unit as the span's total.
+            for(std::size_t i = 0; i < recs.size(); i++) {
+                if(i > 0) recs[i].elapsed = unit_traits<T>::count(recs[i].elapsed_ns, recs[i].elapsed_ns);
+                recs[i].self = unit_traits<T>::count(recs[i].self_ns, recs[i].elapsed_ns);
             }
-            benchmark_log << std::endl << std::endl;
-            benchmark_log.close();
-            bench_mtx.unlock();
+            benchmark_output::instance().write(recs.data(), recs.size());
+        };
+
+        /*!
+         * \brief Stop benchmark and record to the latency histogram for this label.
+         * Does not write to the log.  Objects on many threads may share a label.
+         */
+        void record(void) {
+            if(!active) return;
+            const auto elapsed = std::chrono::system_clock::now() - start_bench - overhead;
+            const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+            if(histogram == nullptr) histogram = &latency_recorder::instance().get(benchmark_label);
+            histogram->record(ns < 0 ? 0 : static_cast<std::uint64_t>(ns));
+        };
+
+        /*!
+         * \brief Get the time measured by the last stop().
+         * \return Elapsed time, zero if not measured or instrumentation is off.
+         */
+        std::chrono::nanoseconds elapsed(void) const {
+            if(!active) return std::chrono::nanoseconds(0);
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(end_bench - start_bench);
         };
 
     private:
-        void verify(void) {
-            static_assert(
-                std::is_same_v<T, std::chrono::nanoseconds> ||
-                std::is_same_v<T, std::chrono::microseconds> ||
-                std::is_same_v<T, std::chrono::milliseconds> ||
-                std::is_same_v<T, std::chrono::seconds> ||
-                std::is_same_v<T, std::chrono::minutes> ||
-                std::is_same_v<T, std::chrono::hours>,
-                "Incorrect benchmark type."
-            );
+        /*
+         * Stop the sampling profiler and append its folded stacks.
+         */
+        void write_profile(void) {
+            sampler->stop();
+            if(sampler->size() == 0) return;
+            const std::filesystem::path parent = std::filesystem::path(profile_path).parent_path();
+            std::error_code ec;
+            if(!parent.empty()) std::filesystem::create_directories(parent, ec);
+            std::ofstream profile(profile_path, std::ios::app);
+            if(!profile.is_open()) throw std::runtime_error("Unable to open benchmark profile:  " + profile_path);
+            sampler->write_folded(profile, benchmark_label);
         };
-        std::mutex bench_mtx;               //  Thread safety for logging
+
         const std::string benchmark_label;  //  Name of benchmark
-        const std::string time_label;       //  Duration type for logging
+        bool active = false;                //  Instrumentation enabled when start() was called
         //  Start / end points for benchmark:
         std::chrono::system_clock::time_point start_bench, end_bench;
-};
-
-/*
- * Constructor specializations for different duration types.
- * Depending on the template used, the correct duration type will be displayed in the log.
- */
+        //  Histogram series for this label, looked up on first record.
+        latency_recorder::series* histogram = nullptr;
+        std::unique_ptr<perf_counters> counters;  //  Hardware counters, null if not in use
+        std::uint64_t iterations = 1;             //  Iterations in the measured region
+        std::uint64_t bytes = 0;                  //  Bytes processed in the measured region
+        bool allocs_enabled = false;              //  Track allocations in the measured region
+        alloc_region allocs;                      //  Allocation counts since start()
+        bool cpu_enabled = false;                 //  Measure CPU usage in the measured region
+        cpu_usage cpu;                            //  CPU usage since start()
+        std::chrono::nanoseconds overhead {0};    //  Clock read cost removed from measurements
+        std::uint64_t items = 0;                  //  Items processed in the measured region
+        std::unique_ptr<sampling_profiler> sampler;  //  Sampling profiler, null if not in use
+        std::string profile_path;                 //  Folded stack output
 
-/*!
- * \brief Benchmark in microseconds.
- */
-template <> inline benchmark<std::chrono::microseconds>::benchmark(const std::string& label) :
-benchmark_label(label), time_label("microseconds") {};
-
-/*!
- * \brief Benchmark in milliseconds.
- */
-template <> inline benchmark<std::chrono::milliseconds>::benchmark(const std::string& label) :
-benchmark_label(label), time_label("milliseconds") {};
-
-/*!
- * \brief Benchmark in seconds.
- */
-template <> inline benchmark<std::chrono::seconds>::benchmark(const std::string& label) :
-benchmark_label(label), time_label("seconds") {};
-
-/*!
- * \brief Benchmark in minutes.
- */
-template <> inline benchmark<std::chrono::minutes>::benchmark(const std::string& label) :
-benchmark_label(label), time_label("minutes") {};
-
-/*!
- * \brief Benchmark in hours.
- */
-template <> inline benchmark<std::chrono::hours>::benchmark(const std::string& label) :
-benchmark_label(label), time_label("hours") {};
+        //  Child span or lap, stored in start order.
+        struct span_node {
+            std::string name;
+            std::size_t parent;  //  Index of the parent span, no_parent for the root
+            std::size_t depth;
+            std::chrono::system_clock::time_point start, end;
+            std::chrono::system_clock::time_point mark;  //  End of the last lap inside this span
+        };
+        static constexpr std::size_t no_parent = static_cast<std::size_t>(-1);
+        std::vector<span_node> spans;                  //  All spans since start()
+        std::vector<std::size_t> open_spans;           //  Stack of open span indices
+        std::chrono::system_clock::time_point lap_mark;  //  End of the last lap at the root
+};
 
 }  //  end namespace wtf
 
+#endif  //  WTF_BENCHMARK_DISABLE
+
 #endif
@@ -0,0 +1,331 @@
+/*
+ * Benchmark Comparison
+ * By:  Matthew Evans
+ * File:  benchmark_compare.hpp
+ * Version:  101826
+ *
+ * See LICENSE.md for copyright information.
+ *
+ * Compare two sets of benchmark results written in the JSON lines or CSV
+ * format (see benchmark_output.hpp).  Only timing records are loaded, so
+ * counter, gauge and baseline records in the same log are skipped.
+ * Samples are grouped by label and tested with a two sided Mann-Whitney U
+ * test.  A label is flagged as a regression when its median slows down by
+ * more than the threshold and the difference is significant.
+ *
+ * Small sample sets without ties use the exact distribution of U, larger
+ * ones the normal approximation.  A label with so few samples that no
+ * difference could reach significance is flagged as insufficient rather
+ * than passed, eg a single run in each log.
+ *
+ * The tools/benchmark_compare.cpp program wraps this for use in scripts.
+ *
+ * Example:
+ *
+ * auto base = wtf::load_benchmark_results("base.jsonl");
+ * auto cand = wtf::load_benchmark_results("cand.jsonl");
+ * auto res = wtf::compare_benchmarks(base, cand, 5.0, 0.05);
+ * wtf::print_comparison(std::cout, res);
+ *
+ */
+
+#ifndef WTF_BENCHMARK_COMPARE_HPP
+#define WTF_BENCHMARK_COMPARE_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <ostream>
+#include <iomanip>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <stdexcept>
+#include <utility>
+
+namespace wtf {
+
+//!  Elapsed nanoseconds for each sample, keyed by label.
+using benchmark_results = std::map<std::string, std::vector<double>>;
+
+/*!
+ * \struct benchmark_comparison
+ * \brief Result of comparing one label between two runs.
+ */
+struct benchmark_comparison {
+    std::string label;              //!<  Benchmark label.
+    std::size_t base_count = 0;     //!<  Baseline sample count.
+    std::size_t cand_count = 0;     //!<  Candidate sample count.
+    double base_median = 0.0;       //!<  Baseline median, nanoseconds.
+    double cand_median = 0.0;       //!<  Candidate median, nanoseconds.
+    double delta_pct = 0.0;         //!<  Change in median, percent.  Positive is slower.
+    double p_value = 1.0;           //!<  Two sided Mann-Whitney U p-value.
+    bool significant = false;       //!<  True if p_value is below alpha.
+    bool regression = false;        //!<  True if significantly slower by more than the threshold.
+    bool insufficient = false;      //!<  True if there are too few samples to reach significance.
+};
+
+namespace detail {
+
+/*
+ * Find the position of the value for a key in a flat JSON object.
+ */
+inline std::size_t find_json_value(const std::string& line, const std::string& key) {
+    std::size_t pos = line.find("\"" + key + "\"");
+    if(pos == std::string::npos) return pos;
+    pos += key.size() + 2;
+    while(pos < line.size() && (line[pos] == ' ' || line[pos] == ':')) pos++;
+    return pos < line.size() ? pos : std::string::npos;
+};
+
+/*
+ * Read a JSON string value starting after the opening quote.
+ */
+inline std::string read_json_string(const std::string& line, std::size_t pos) {
+    std::string res;
+    while(pos < line.size() && line[pos] != '"') {
+        if(line[pos] == '\\' && pos + 1 < line.size()) {
+            pos++;
+            switch(line[pos]) {
+                case 'n': res += '\n'; break;
+                case 'r': res += '\r'; break;
+                case 't': res += '\t'; break;
+                case 'u':
+                    res += static_cast<char>(std::strtol(line.substr(pos + 1, 4).c_str(), nullptr, 16));
+                    pos += 4;
+                    break;
+                default:  res += line[pos];
+            }
+        } else res += line[pos];
+        pos++;
+    }
+    return res;
+};
+
+/*
+ * Split a CSV line, handling quoted fields.
+ */
+inline std::vector<std::string> split_csv(const std::string& line) {
+    std::vector<std::string> res(1);
+    bool quoted = false;
+    for(std::size_t i = 0; i < line.size(); i++) {
+        const char c = line[i];
+        if(quoted) {
+            if(c == '"' && i + 1 < line.size() && line[i + 1] == '"') { res.back() += '"'; i++; }
+            else if(c == '"') quoted = false;
+            else res.back() += c;
+        } else {
+            if(c == '"') quoted = true;
+            else if(c == ',') res.emplace_back();
+            else if(c != '\r') res.back() += c;
+        }
+    }
+    return res;
+};
+
+//  Largest n1 * n2 tested with the exact distribution of U.
+inline constexpr std::size_t exact_u_limit = 400;
+
+//  Ways to arrange n1 and n2 samples, C(n1 + n2, n1).
+inline double arrangements(const std::size_t& n1, const std::size_t& n2) {
+    double res = 1.0;
+    for(std::size_t i = 1; i <= n1; i++)
+        res = res * static_cast<double>(n2 + i) / static_cast<double>(i);
+    return res;
+};
+
+//  Two sided p-value of U from the exact distribution, assuming no ties.
+inline double exact_u_p_value(const std::size_t& n1, const std::size_t& n2, const double& u) {
+    //  dist[n][k] counts arrangements of m and n samples with U = k, built up one m at a time.
+    std::vector<std::vector<double>> dist(n2 + 1, std::vector<double>(1, 1.0));
+    for(std::size_t m = 1; m <= n1; m++) {
+        for(std::size_t n = 1; n <= n2; n++) {
+            std::vector<double> next(m * n + 1, 0.0);
+            for(std::size_t k = 0; k < dist[n].size(); k++) next[k + n] += dist[n][k];
+            for(std::size_t k = 0; k < dist[n - 1].size(); k++) next[k] += dist[n - 1][k];
+            dist[n] = std::move(next);
+        }
+    }
+    const std::vector<double>& counts = dist[n2];
+    const std::size_t at = static_cast<std::size_t>(u + 0.5);
+    double below = 0.0, above = 0.0, total = 0.0;
+    for(std::size_t k = 0; k < counts.size(); k++) {
+        total += counts[k];
+        if(k <= at) below += counts[k];
+        if(k >= at) above += counts[k];
+    }
+    return std::min(1.0, 2.0 * std::min(below, above) / total);
+};
+
+inline double median(std::vector<double> values) {
+    if(values.empty()) return 0.0;
+    std::sort(values.begin(), values.end());
+    const std::size_t mid = values.size() / 2;
+    return (values.size() % 2) ? values[mid] : (values[mid - 1] + values[mid]) / 2.0;
+};
+
+}  //  end namespace detail
+
+/*!
+ * \brief Load results from a JSON lines or CSV benchmark log.
+ * The format is detected from the first line.  Records with a type other
+ * than "timing" are skipped.  Logs without types are read as all timings.
+ * \param file_name File to read.
+ * \return Samples grouped by label.
+ * \throws std::runtime_error if the file can not be read.
+ */
+inline benchmark_results load_benchmark_results(const std::string& file_name) {
+    std::ifstream in(file_name);
+    if(!in.is_open()) throw std::runtime_error("Unable to open results:  " + file_name);
+
+    benchmark_results results;
+    std::string line;
+    std::size_t label_col = 0, elapsed_col = 0, type_col = 0;
+    bool csv = false, first = true;
+    while(std::getline(in, line)) {
+        if(line.empty()) continue;
+        if(first) {
+            first = false;
+            if(line[0] != '{') {
+                //  CSV header, find the columns we need.
+                csv = true;
+                const std::vector<std::string> cols = detail::split_csv(line);
+                auto label_it = std::find(cols.begin(), cols.end(), "label");
+                auto elapsed_it = std::find(cols.begin(), cols.end(), "elapsed_ns");
+                if(label_it == cols.end() || elapsed_it == cols.end())
+                    throw std::runtime_error("Missing label or elapsed_ns column:  " + file_name);
+                label_col = label_it - cols.begin();
+                elapsed_col = elapsed_it - cols.begin();
+                type_col = std::find(cols.begin(), cols.end(), "type") - cols.begin();
+                continue;
+            }
+        }
+        if(csv) {
+            const std::vector<std::string> fields = detail::split_csv(line);
+            if(fields.size() <= std::max(label_col, elapsed_col)) continue;
+            if(type_col < fields.size() && !fields[type_col].empty() && fields[type_col] != "timing") continue;
+            results[fields[label_col]].push_back(std::strtod(fields[elapsed_col].c_str(), nullptr));
+        } else {
+            const std::size_t label_pos = detail::find_json_value(line, "label");
+            const std::size_t elapsed_pos = detail::find_json_value(line, "elapsed_ns");
+            if(label_pos == std::string::npos || elapsed_pos == std::string::npos) continue;
+            if(line[label_pos] != '"') continue;
+            const std::size_t type_pos = detail::find_json_value(line, "type");
+            if(type_pos != std::string::npos && line[type_pos] == '"' &&
+               detail::read_json_string(line, type_pos + 1) != "timing") continue;
+            results[detail::read_json_string(line, label_pos + 1)].push_back(
+                std::strtod(line.c_str() + elapsed_pos, nullptr));
+        }
+    }
+    return results;
+};
+
+/*!
+ * \brief Two sided Mann-Whitney U test.
+ * Uses the exact distribution of U for small sets without ties, otherwise
+ * the normal approximation with the correction for ties.
+ * \param a First sample set.
+ * \param b Second sample set.
+ * \return p-value.  Returns 1 if either set is empty.
+ */
+inline double mann_whitney_u(const std::vector<double>& a, const std::vector<double>& b) {
+    if(a.empty() || b.empty()) return 1.0;
+    const double n1 = static_cast<double>(a.size());
+    const double n2 = static_cast<double>(b.size());
+
+    //  Rank the combined samples, averaging ranks over ties.
+    std::vector<std::pair<double, bool>> all;
+    all.reserve(a.size() + b.size());
+    for(const double& v : a) all.emplace_back(v, true);
+    for(const double& v : b) all.emplace_back(v, false);
+    std::sort(all.begin(), all.end(),
+        [](const auto& x, const auto& y) { return x.first < y.first; });
+
+    double rank_sum_a = 0.0, tie_term = 0.0;
+    for(std::size_t i = 0; i < all.size();) {
+        std::size_t j = i;
+        while(j < all.size() && all[j].first == all[i].first) j++;
+        const double avg_rank = (static_cast<double>(i + 1) + static_cast<double>(j)) / 2.0;
+        for(std::size_t k = i; k < j; k++) if(all[k].second) rank_sum_a += avg_rank;
+        const double t = static_cast<double>(j - i);
+        tie_term += t * t * t - t;
+        i = j;
+    }
+
+    const double u = rank_sum_a - n1 * (n1 + 1.0) / 2.0;
+    if(tie_term == 0.0 && a.size() * b.size() <= detail::exact_u_limit)
+        return detail::exact_u_p_value(a.size(), b.size(), u);
+    const double mean_u = n1 * n2 / 2.0;
+    const double n = n1 + n2;
+    const double var_u = (n1 * n2 / 12.0) * ((n + 1.0) - tie_term / (n * (n - 1.0)));
+    if(var_u <= 0.0) return 1.0;
+    //  Continuity correction.
+    const double diff = std::fabs(u - mean_u) - 0.5;
+    const double z = (diff < 0.0 ? 0.0 : diff) / std::sqrt(var_u);
+    return std::erfc(z / std::sqrt(2.0));
+};
+
+/*!
+ * \brief Compare every label found in both result sets.
+ * \param base Baseline results.
+ * \param cand Candidate results.
+ * \param threshold_pct Slowdown in percent needed to flag a regression.
+ * \param alpha Significance level.
+ * \return Comparison for each shared label.
+ */
+inline std::vector<benchmark_comparison> compare_benchmarks(
+    const benchmark_results& base,
+    const benchmark_results& cand,
+    const double& threshold_pct,
+    const double& alpha
+) {
+    std::vector<benchmark_comparison> res;
+    for(auto& b : base) {
+        auto c = cand.find(b.first);
+        if(c == cand.end()) continue;
+        benchmark_comparison cmp;
+        cmp.label = b.first;
+        cmp.base_count = b.second.size();
+        cmp.cand_count = c->second.size();
+        cmp.base_median = detail::median(b.second);
+        cmp.cand_median = detail::median(c->second);
+        if(cmp.base_median > 0.0)
+            cmp.delta_pct = (cmp.cand_median - cmp.base_median) / cmp.base_median * 100.0;
+        cmp.p_value = mann_whitney_u(b.second, c->second);
+        //  The smallest p-value possible is when the sets do not overlap at all.
+        cmp.insufficient = 2.0 / detail::arrangements(cmp.base_count, cmp.cand_count) >= alpha;
+        cmp.significant = (cmp.p_value < alpha);
+        cmp.regression = cmp.significant && (cmp.delta_pct > threshold_pct);
+        res.push_back(cmp);
+    }
+    return res;
+};
+
+/*!
+ * \brief Print a comparison table.
+ * The stream's formatting is left as it was.
+ * \param out Stream to write to.
+ * \param res Comparison results.
+ */
+inline void print_comparison(std::ostream& out, const std::vector<benchmark_comparison>& res) {
+    std::ios state(nullptr);
+    state.copyfmt(out);
+    out << std::left << std::setw(32) << "Benchmark" << std::right <<
+        std::setw(14) << "Base (ns)" << std::setw(14) << "New (ns)" <<
+        std::setw(10) << "Delta" << std::setw(10) << "p" << "  Result" << std::endl;
+    for(auto& cmp : res) {
+        out << std::left << std::setw(32) << cmp.label << std::right << std::fixed <<
+            std::setprecision(0) << std::setw(14) << cmp.base_median << std::setw(14) << cmp.cand_median <<
+            std::setprecision(1) << std::setw(9) << std::showpos << cmp.delta_pct << std::noshowpos << "%" <<
+            std::setprecision(4) << std::setw(10) << cmp.p_value << "  " <<
+            (cmp.regression ? "REGRESSION" : cmp.insufficient ? "too few samples" :
+                (cmp.significant ? (cmp.delta_pct < 0.0 ? "faster" : "slower") : "same")) <<
+            std::endl;
+    }
+    out.copyfmt(state);
+};
+
+}  //  end namespace wtf
+
+#endif
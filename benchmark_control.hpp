@@ -0,0 +1,95 @@
+/*
+ * Benchmark Control
+ * By:  Matthew Evans
+ * File:  benchmark_control.hpp
+ * Version:  101826
+ *
+ * See LICENSE.md for copyright information.
+ *
+ * Switch benchmark instrumentation off at compile time or run time.
+ *
+ * Define WTF_BENCHMARK_DISABLE before including benchmark.hpp (or on the
+ * command line) to replace benchmark with an empty class.  Every call is
+ * an empty inline function and the optimizer removes them completely.
+ *
+ * In builds that keep instrumentation, set_benchmark_enabled(false) turns
+ * it off at run time.  start() reads the flag once and the other calls test
+ * the saved value, a single well predicted branch.  Setting the environment
+ * variable WTF_BENCHMARK_ENABLED=0 starts the program with it off.  The
+ * variable is read on the first check rather than during static
+ * initialization, so benchmarks run from other static constructors see it.
+ *
+ * Example:
+ *
+ * g++ -DWTF_BENCHMARK_DISABLE ...       //  No instrumentation
+ *
+ * wtf::set_benchmark_enabled(config.profiling);
+ *
+ */
+
+#ifndef WTF_BENCHMARK_CONTROL_HPP
+#define WTF_BENCHMARK_CONTROL_HPP
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+
+namespace wtf {
+
+//!  False when instrumentation is compiled out with WTF_BENCHMARK_DISABLE.
+#if defined(WTF_BENCHMARK_DISABLE)
+inline constexpr bool benchmark_compiled = false;
+#else
+inline constexpr bool benchmark_compiled = true;
+#endif
+
+namespace detail {
+
+//  Run time switch states.  Unset until the environment is read or a value is set.
+enum runtime_switch : int { benchmark_unset = 0, benchmark_on = 1, benchmark_off = 2 };
+
+//  Constant initialized, so it is valid before any dynamic initialization runs.
+inline std::atomic<int> benchmark_runtime_state {benchmark_unset};
+
+inline bool benchmark_default_enabled(void) {
+    const char* env = std::getenv("WTF_BENCHMARK_ENABLED");
+    return env == nullptr || std::strcmp(env, "0") != 0;
+};
+
+//  Read the environment on first use.  A value set meanwhile wins.
+inline bool benchmark_first_check(void) noexcept {
+    int state = benchmark_unset;
+    benchmark_runtime_state.compare_exchange_strong(state,
+        benchmark_default_enabled() ? benchmark_on : benchmark_off, std::memory_order_relaxed);
+    return benchmark_runtime_state.load(std::memory_order_relaxed) == benchmark_on;
+};
+
+}  //  end namespace detail
+
+/*!
+ * \brief Check if benchmark instrumentation is on.
+ * \return False if compiled out or switched off at run time.
+ */
+inline bool benchmark_enabled(void) noexcept {
+    if constexpr(!benchmark_compiled) return false;
+    else {
+        const int state = detail::benchmark_runtime_state.load(std::memory_order_relaxed);
+        if(state == detail::benchmark_unset) return detail::benchmark_first_check();
+        return state == detail::benchmark_on;
+    }
+};
+
+/*!
+ * \brief Switch benchmark instrumentation on or off at run time.
+ * Benchmarks already started finish with the setting they started with.
+ * Has no effect when compiled out.
+ * \param enable True to enable.
+ */
+inline void set_benchmark_enabled(const bool& enable) noexcept {
+    detail::benchmark_runtime_state.store(enable ? detail::benchmark_on : detail::benchmark_off,
+                                          std::memory_order_relaxed);
+};
+
+}  //  end namespace wtf
+
+#endif
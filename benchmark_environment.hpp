@@ -0,0 +1,199 @@
+/*
+ * Benchmark Environment
+ * By:  Matthew Evans
+ * File:  benchmark_environment.hpp
+ * Version:  101826
+ *
+ * See LICENSE.md for copyright information.
+ *
+ * Reduce and record run to run noise.
+ * Pin the benchmark thread to a core, raise its priority, and read the
+ * system state that affects results:  frequency governor, turbo, SMT
+ * siblings and load.  System state is read from /sys and /proc on Linux.
+ * Elsewhere pinning and priority return false and the state is mostly empty.
+ *
+ * Example:
+ *
+ * wtf::pin_thread(2);
+ * wtf::system_state state = wtf::read_system_state(2);
+ * for(auto& w : state.warnings()) std::cerr << "Warning:  " << w << std::endl;
+ * wtf::benchmark_output::instance().write_metadata(state.metadata());
+ *
+ */
+
+#ifndef WTF_BENCHMARK_ENVIRONMENT_HPP
+#define WTF_BENCHMARK_ENVIRONMENT_HPP
+
+#include <string>
+#include <vector>
+#include <set>
+#include <fstream>
+#include <utility>
+#include <thread>
+#include <cstdlib>
+
+#if defined(__linux__)
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
+#endif
+
+namespace wtf {
+
+/*!
+ * \brief Pin the calling thread to one CPU.
+ * \param cpu CPU number.
+ * \return True on success.
+ */
+inline bool pin_thread(const int& cpu) {
+#if defined(__linux__)
+    if(cpu < 0 || cpu >= CPU_SETSIZE) return false;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    (void)cpu;
+    return false;
+#endif
+};
+
+/*!
+ * \brief Get the CPU the calling thread is running on.
+ * \return CPU number, or -1 if unknown.
+ */
+inline int current_cpu(void) {
+#if defined(__linux__)
+    return sched_getcpu();
+#else
+    return -1;
+#endif
+};
+
+/*!
+ * \brief Raise the scheduling priority of the calling thread to the highest nice level.
+ * Usually needs root or CAP_SYS_NICE.
+ * \return True on success.
+ */
+inline bool raise_priority(void) {
+#if defined(__linux__)
+    const id_t tid = static_cast<id_t>(syscall(SYS_gettid));
+    return setpriority(PRIO_PROCESS, tid, -20) == 0;
+#else
+    return false;
+#endif
+};
+
+/*!
+ * \struct system_state
+ * \brief System settings that affect benchmark results.
+ */
+struct system_state {
+    std::string host;                   //!<  Host name.
+    std::string kernel;                 //!<  Kernel release.
+    unsigned int cpus = 0;              //!<  Online CPUs.
+    int cpu = -1;                       //!<  CPU the benchmark runs on, -1 if not pinned.
+    std::set<std::string> governors;    //!<  Frequency governors in use.
+    int turbo = -1;                     //!<  1 if turbo / boost is on, 0 if off, -1 if unknown.
+    int smt = -1;                       //!<  1 if SMT is active, 0 if not, -1 if unknown.
+    std::string siblings;               //!<  SMT siblings of the benchmark CPU.
+    long cur_freq_khz = -1;             //!<  Current frequency of the benchmark CPU.
+    double load[3] = { -1.0, -1.0, -1.0 };  //!<  1, 5 and 15 minute load averages.
+
+    /*!
+     * \brief Get warnings about settings likely to add noise.
+     * \return Warning messages, empty if none.
+     */
+    std::vector<std::string> warnings(void) const {
+        std::vector<std::string> res;
+        for(auto& g : governors)
+            if(g != "performance") res.push_back("CPU frequency governor is '" + g + "', use 'performance'.");
+        if(turbo == 1) res.push_back("CPU turbo / boost is enabled.");
+        if(cpu >= 0 && siblings.find_first_of(",-") != std::string::npos)
+            res.push_back("CPU " + std::to_string(cpu) + " shares a core with SMT siblings " + siblings + ".");
+        if(cpu < 0) res.push_back("Benchmark thread is not pinned to a CPU.");
+        if(cpus > 0 && load[0] > 0.1 * cpus)
+            res.push_back("System load is " + std::to_string(load[0]) + ".");
+        return res;
+    };
+
+    /*!
+     * \brief Get the state as key / value pairs for benchmark_output::write_metadata().
+     * \return Metadata.
+     */
+    std::vector<std::pair<std::string, std::string>> metadata(void) const {
+        std::string gov;
+        for(auto& g : governors) gov += (gov.empty() ? "" : ",") + g;
+        return {
+            { "host", host },
+            { "kernel", kernel },
+            { "cpus", std::to_string(cpus) },
+            { "cpu", std::to_string(cpu) },
+            { "governor", gov },
+            { "turbo", std::to_string(turbo) },
+            { "smt", std::to_string(smt) },
+            { "smt_siblings", siblings },
+            { "cur_freq_khz", std::to_string(cur_freq_khz) },
+            { "load_1m", std::to_string(load[0]) },
+            { "load_5m", std::to_string(load[1]) },
+            { "load_15m", std::to_string(load[2]) }
+        };
+    };
+};
+
+namespace detail {
+
+inline std::string read_sys_line(const std::string& path) {
+    std::ifstream in(path);
+    std::string line;
+    if(in.is_open()) std::getline(in, line);
+    return line;
+};
+
+}  //  end namespace detail
+
+/*!
+ * \brief Read the current system state.
+ * \param cpu CPU the benchmark is pinned to, or -1 if not pinned.
+ * \return System state.  Unknown values are left at their defaults.
+ */
+inline system_state read_system_state(const int& cpu = -1) {
+    system_state state;
+    state.cpu = cpu;
+    state.cpus = std::thread::hardware_concurrency();
+#if defined(__linux__)
+    utsname un;
+    if(uname(&un) == 0) {
+        state.host = un.nodename;
+        state.kernel = un.release;
+    }
+    const std::string sys_cpu = "/sys/devices/system/cpu/";
+    for(unsigned int i = 0; i < state.cpus; i++) {
+        const std::string gov = detail::read_sys_line(sys_cpu + "cpu" + std::to_string(i) + "/cpufreq/scaling_governor");
+        if(!gov.empty()) state.governors.insert(gov);
+    }
+    //  intel_pstate reports no_turbo, acpi-cpufreq reports boost.
+    const std::string no_turbo = detail::read_sys_line(sys_cpu + "intel_pstate/no_turbo");
+    const std::string boost = detail::read_sys_line(sys_cpu + "cpufreq/boost");
+    if(!no_turbo.empty()) state.turbo = (no_turbo == "0") ? 1 : 0;
+    else if(!boost.empty()) state.turbo = (boost == "1") ? 1 : 0;
+    const std::string smt = detail::read_sys_line(sys_cpu + "smt/active");
+    if(!smt.empty()) state.smt = (smt == "1") ? 1 : 0;
+    if(cpu >= 0) {
+        const std::string cpu_dir = sys_cpu + "cpu" + std::to_string(cpu);
+        state.siblings = detail::read_sys_line(cpu_dir + "/topology/thread_siblings_list");
+        const std::string freq = detail::read_sys_line(cpu_dir + "/cpufreq/scaling_cur_freq");
+        if(!freq.empty()) state.cur_freq_khz = std::atol(freq.c_str());
+    }
+    double load[3];
+    if(getloadavg(load, 3) == 3) for(int i = 0; i < 3; i++) state.load[i] = load[i];
+#endif
+    return state;
+};
+
+}  //  end namespace wtf
+
+#endif
@@ -0,0 +1,200 @@
+/*
+ * Benchmark Measure
+ * By:  Matthew Evans
+ * File:  benchmark_measure.hpp
+ * Version:  101826
+ *
+ * See LICENSE.md for copyright information.
+ *
+ * Time callables without managing a benchmark object.
+ *
+ *   measure()   Call once, returning the result and the time taken.  Logged
+ *               the same way as benchmark::stop().
+ *   bench()     Call in a tight loop.  The cost of the loop itself is
+ *               measured once per process and subtracted, so very short
+ *               operations are timed accurately.
+ *
+ * do_not_optimize() keeps the compiler from removing work whose result is
+ * not used.  bench() already applies it to the callable's return value.
+ *
+ * Example:
+ *
+ * auto hashed = wtf::measure("md5 file", hash_file, "data.bin");
+ * std::cout << hashed.value << " in " << hashed.elapsed.count() << " ns";
+ *
+ * auto res = wtf::bench("md5 16 bytes", 1000000, [&] { return md5_of(key, 16); });
+ * std::cout << res.ns_per_iteration << " ns per hash";
+ *
+ */
+
+#ifndef WTF_BENCHMARK_MEASURE_HPP
+#define WTF_BENCHMARK_MEASURE_HPP
+
+#include <string>
+#include <chrono>
+#include <functional>
+#include <type_traits>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+
+#include "benchmark.hpp"
+
+namespace wtf {
+
+/*!
+ * \brief Keep a value and the work producing it from being optimized away.
+ * \param value Value to keep.
+ */
+template <typename V>
+inline void do_not_optimize(V const& value) {
+#if defined(__GNUC__)
+    asm volatile("" : : "r,m"(value) : "memory");
+#else
+    static volatile const void* sink;
+    sink = &value;
+#endif
+};
+
+/*!
+ * \brief Force pending writes to memory, so stores are not removed.
+ */
+inline void clobber_memory(void) {
+#if defined(__GNUC__)
+    asm volatile("" : : : "memory");
+#else
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+#endif
+};
+
+/*!
+ * \struct measured
+ * \brief Result of a measured call and the time it took.
+ * \tparam R Return type of the call.
+ */
+template <typename R>
+struct measured {
+    R value;                           //!<  Value returned by the call.
+    std::chrono::nanoseconds elapsed;  //!<  Time taken.  Zero if instrumentation is off.
+};
+
+/*!
+ * \struct measured
+ * \brief Time taken by a measured call that returns nothing.
+ */
+template <>
+struct measured<void> {
+    std::chrono::nanoseconds elapsed;  //!<  Time taken.  Zero if instrumentation is off.
+};
+
+/*!
+ * \brief Call a function once and log the time taken.
+ * \tparam T Duration type for the log, see benchmark.
+ * \param label Benchmark label.
+ * \param fn Function to call.
+ * \param args Arguments passed to the function.
+ * \return The function's result and the time taken.
+ */
+template <typename T = std::chrono::nanoseconds, typename L, typename F, typename... A>
+inline auto measure(const L& label, F&& fn, A&&... args) {
+    using R = std::invoke_result_t<F, A...>;
+    benchmark<T> bench(label);
+    bench.start();
+    if constexpr(std::is_void_v<R>) {
+        std::invoke(std::forward<F>(fn), std::forward<A>(args)...);
+        bench.stop();
+        return measured<void> { bench.elapsed() };
+    } else {
+        R res = std::invoke(std::forward<F>(fn), std::forward<A>(args)...);
+        bench.stop();
+        return measured<R> { std::forward<R>(res), bench.elapsed() };
+    }
+};
+
+/*!
+ * \struct bench_result
+ * \brief Timing of a loop run by bench().
+ */
+struct bench_result {
+    std::uint64_t iterations = 0;      //!<  Calls made.
+    std::int64_t total_ns = 0;         //!<  Time for all calls, loop overhead removed.
+    double overhead_ns = 0.0;          //!<  Loop overhead per iteration that was removed.
+    double ns_per_iteration = 0.0;     //!<  Time per call.
+};
+
+/*!
+ * \brief Get the cost of one iteration of an empty bench() loop.
+ * Measured on first use, taking the fastest of several runs.
+ * \return Nanoseconds per iteration.
+ */
+inline double loop_overhead_ns(void) {
+    static const double overhead = [] {
+        constexpr std::uint64_t n = 1 << 20;
+        double best = 0.0;
+        for(int run = 0; run < 5; run++) {
+            const auto start = std::chrono::steady_clock::now();
+            for(std::uint64_t i = 0; i < n; i++) do_not_optimize(i);
+            const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count();
+            const double per = static_cast<double>(ns) / static_cast<double>(n);
+            if(run == 0 || per < best) best = per;
+        }
+        return best;
+    }();
+    return overhead;
+};
+
+/*!
+ * \brief Call a function in a loop and log the time per call.
+ * The return value of each call is kept with do_not_optimize().
+ * Logged with the iteration count and ns_per_iteration and
+ * loop_overhead_ns metrics, unless instrumentation is off.
+ * \param label Benchmark label.
+ * \param iterations Number of calls.
+ * \param fn Function to call, taking no arguments.
+ * \return Timing with loop overhead removed.
+ */
+template <typename L, typename F>
+inline bench_result bench(const L& label, const std::uint64_t& iterations, F&& fn) {
+    bench_result res;
+    res.iterations = iterations;
+    res.overhead_ns = loop_overhead_ns();
+    const auto wall_start = std::chrono::system_clock::now();
+    const auto start = std::chrono::steady_clock::now();
+    for(std::uint64_t i = 0; i < iterations; i++) {
+        if constexpr(std::is_void_v<std::invoke_result_t<F>>) fn();
+        else do_not_optimize(fn());
+    }
+    const auto raw = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count();
+    const double corrected = static_cast<double>(raw) - res.overhead_ns * static_cast<double>(iterations);
+    res.total_ns = std::max<std::int64_t>(static_cast<std::int64_t>(corrected), 0);
+    if(iterations > 0) res.ns_per_iteration = static_cast<double>(res.total_ns) / static_cast<double>(iterations);
+
+#if !defined(WTF_BENCHMARK_DISABLE)
+    if(benchmark_enabled()) {
+        benchmark_record rec;
+        rec.label = label;
+        rec.name = rec.label;
+        rec.start = wall_start;
+        rec.end = wall_start + std::chrono::nanoseconds(raw);
+        rec.elapsed_ns = res.total_ns;
+        rec.elapsed = res.total_ns;
+        rec.self_ns = res.total_ns;
+        rec.self = res.total_ns;
+        rec.unit = "nanoseconds";
+        rec.thread_id = benchmark_output::thread_id();
+        rec.iterations = iterations;
+        rec.metrics = { { "ns_per_iteration", res.ns_per_iteration }, { "loop_overhead_ns", res.overhead_ns } };
+        benchmark_output::instance().write(rec);
+    }
+#else
+    (void)label;
+    (void)wall_start;
+#endif
+    return res;
+};
+
+}  //  end namespace wtf
+
+#endif
@@ -0,0 +1,603 @@
+/*
+ * Benchmark Output
+ * By:  Matthew Evans
+ * File:  benchmark_output.hpp
+ * Version:  101826
+ *
+ * See LICENSE.md for copyright information.
+ *
+ * Formats benchmark results and writes them to a sink.
+ * The format is selected at runtime, either by calling set_format()
+ * or with the WTF_BENCHMARK_FORMAT environment variable.
+ *
+ * Formats and their default log files:
+ *   text    benchmark/log.txt    Human readable (default)
+ *   json    benchmark/log.jsonl  One JSON object per line
+ *   csv     benchmark/log.csv    Header written when the file is created
+ *   chrome  benchmark/trace.json Chrome / Perfetto trace events
+ *
+ * Set WTF_BENCHMARK_LOG to change the default log file, or call
+ * set_sink() to send output elsewhere.  See benchmark_sink.hpp.
+ *
+ * Trace files are written as an unterminated JSON array, which both
+ * chrome://tracing and ui.perfetto.dev accept.  Spans on the same thread
+ * are shown nested by time.
+ *
+ * Run metadata, such as the system state from benchmark_environment.hpp,
+ * is written with write_metadata().  JSON gets a {"type":"metadata"} line
+ * and traces get a global instant event.  CSV has no place for it, so it
+ * is skipped.
+ *
+ * Each record has a type.  Timed runs are "timing", while counter and gauge
+ * reports and memory baselines carry only metrics.  Tools comparing timings
+ * should skip the other types.  Text and trace output leave the type out.
+ *
+ * A benchmark with child spans writes one record per span.  Children are
+ * labeled with their path from the root ("Pipeline/hash") and carry their
+ * depth, parent and self time.  The text format shows them as a tree.
+ *
+ * Example:
+ *
+ * wtf::benchmark_output::instance().set_format(wtf::benchmark_format::json);
+ *
+ */
+
+#ifndef WTF_BENCHMARK_OUTPUT_HPP
+#define WTF_BENCHMARK_OUTPUT_HPP
+
+#include <string>
+#include <sstream>
+#include <chrono>
+#include <ctime>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cmath>
+#include <functional>
+#include <memory>
+#include <vector>
+#include <utility>
+
+#if defined(__linux__)
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
+
+#include "perf_counters.hpp"
+#include "alloc_tracker.hpp"
+#include "cpu_usage.hpp"
+#include "benchmark_sink.hpp"
+
+namespace wtf {
+
+//!  Available output formats.
+enum class benchmark_format { text, json, csv, chrome_trace };
+
+/*!
+ * \struct benchmark_record
+ * \brief A single completed measurement.
+ */
+struct benchmark_record {
+    std::string label;                                 //!<  Benchmark label, or span path.
+    std::string name;                                  //!<  Span name, same as label for the root.
+    std::chrono::system_clock::time_point start;       //!<  Start time.
+    std::chrono::system_clock::time_point end;         //!<  End time.
+    std::int64_t elapsed_ns = 0;                       //!<  Elapsed time in nanoseconds.
+    double elapsed = 0.0;                              //!<  Elapsed time in the benchmark's unit.
+    std::int64_t self_ns = 0;                          //!<  Elapsed time less child spans.
+    double self = 0.0;                                 //!<  Self time in the benchmark's unit.
+    const char* unit = "nanoseconds";                  //!<  Name of the benchmark's unit, a static string.
+    const char* type = "timing";                       //!<  Record type, "timing", "counter", "gauge" or "baseline".
+    std::uint64_t thread_id = 0;                       //!<  Id of the recording thread.
+    std::uint64_t iterations = 1;                      //!<  Iterations in the region.
+    std::uint64_t bytes = 0;                           //!<  Bytes processed, zero if not set.
+    std::uint64_t items = 0;                           //!<  Items processed, zero if not set.
+    std::size_t depth = 0;                             //!<  Span depth, zero for the root.
+    std::int64_t span_id = 0;                          //!<  Span id within the measurement, zero for the root.
+    std::int64_t parent_id = -1;                       //!<  Parent span id, -1 for the root.
+    std::size_t children = 0;                          //!<  Number of direct child spans.
+    bool has_counters = false;                         //!<  True if counters were requested.
+    perf_sample counters;                              //!<  Hardware counters.
+    bool has_allocs = false;                           //!<  True if allocation tracking was requested.
+    alloc_stats allocs;                                //!<  Allocations made in the region.
+    bool has_cpu = false;                              //!<  True if CPU usage was requested.
+    cpu_usage_sample cpu;                              //!<  CPU time, context switches and page faults.
+    std::vector<std::pair<std::string, double>> metrics;  //!<  Extra named results, eg speedup.
+};
+
+/*!
+ * \class benchmark_output
+ * \brief Process wide benchmark log writer.
+ */
+class benchmark_output {
+    public:
+        /*!
+         * \brief Get the process wide writer.
+         * Never destroyed so threads may log during shutdown.  Buffered
+         * output is flushed at exit.
+         */
+        static benchmark_output& instance(void) {
+            static benchmark_output* output = [] {
+                benchmark_output* created = new benchmark_output();
+                std::atexit([] { instance().flush(); });
+                return created;
+            }();
+            return *output;
+        };
+
+        /*!
+         * \brief Set the output format.
+         * \param fmt New format.
+         */
+        void set_format(const benchmark_format& fmt) { format.store(fmt, std::memory_order_relaxed); };
+
+        /*!
+         * \brief Get the output format.
+         * \return Current format.
+         */
+        benchmark_format get_format(void) const { return format.load(std::memory_order_relaxed); };
+
+        /*!
+         * \brief Set the output destination.
+         * \param new_sink Sink to write to.  Pass nullptr to restore the default log file.
+         */
+        void set_sink(const std::shared_ptr<benchmark_sink>& new_sink) {
+            std::lock_guard<std::mutex> lock(output_mtx);
+            if(sink) sink->flush();
+            sink = new_sink;
+            default_sink = false;
+        };
+
+        /*!
+         * \brief Flush buffered output.
+         */
+        void flush(void) {
+            std::lock_guard<std::mutex> lock(output_mtx);
+            if(sink) sink->flush();
+        };
+
+        /*!
+         * \brief Format a record and write it to the sink.
+         * \param rec Record to write.
+         * \throws std::runtime_error if the default log file can not be opened.
+         */
+        void write(const benchmark_record& rec) { write(&rec, 1); };
+
+        /*!
+         * \brief Format a set of records and write them to the sink together.
+         * Used for a measurement and its child spans.
+         * \param recs Records to write, root first.
+         * \param count Number of records.
+         * \throws std::runtime_error if the default log file can not be opened.
+         */
+        void write(const benchmark_record* recs, const std::size_t& count) {
+            const benchmark_format fmt = get_format();
+            std::lock_guard<std::mutex> lock(output_mtx);  //  Lock so multiple threads don't write at once.
+            open_default_sink(fmt);
+            std::string data;
+            for(std::size_t i = 0; i < count; i++) data += format_record(recs[i], fmt, sink->at_start() && i == 0);
+            if(fmt == benchmark_format::text) data += "\n";  //  Blank line between measurements
+            sink->write(data);
+        };
+
+        /*!
+         * \brief Write run metadata to the sink.
+         * \param meta Key / value pairs.
+         * \throws std::runtime_error if the default log file can not be opened.
+         */
+        void write_metadata(const std::vector<std::pair<std::string, std::string>>& meta) {
+            const benchmark_format fmt = get_format();
+            if(fmt == benchmark_format::csv) return;
+            std::lock_guard<std::mutex> lock(output_mtx);
+            open_default_sink(fmt);
+            std::ostringstream out;
+            switch(fmt) {
+                case benchmark_format::json:
+                    out << "{\"type\":\"metadata\",\"pid\":" << process_id();
+                    for(auto& m : meta) out << ",\"" << json_escape(m.first) << "\":\"" << json_escape(m.second) << "\"";
+                    out << "}\n";
+                    break;
+                case benchmark_format::chrome_trace:
+                    if(sink->at_start()) out << "[\n";
+                    out << "{\"name\":\"metadata\",\"ph\":\"i\",\"s\":\"g\",\"ts\":" <<
+                        epoch_ns(std::chrono::system_clock::now()) / 1000 << ",\"pid\":" << process_id() <<
+                        ",\"tid\":" << thread_id() << ",\"args\":{";
+                    for(std::size_t i = 0; i < meta.size(); i++)
+                        out << (i == 0 ? "" : ",") << "\"" << json_escape(meta[i].first) << "\":\"" <<
+                            json_escape(meta[i].second) << "\"";
+                    out << "}},\n";
+                    break;
+                default:
+                    out << "System:" << std::endl;
+                    for(auto& m : meta) out << "  " << m.first << ":  " << m.second << std::endl;
+                    out << std::endl;
+            }
+            sink->write(out.str());
+        };
+
+        /*!
+         * \brief Format a record.
+         * \param rec Record to format.
+         * \param fmt Format to use.
+         * \param first True if this is the first record in the output.
+         *        Adds the CSV header or opens the trace array.
+         * \return Formatted record.
+         */
+        static std::string format_record(
+            const benchmark_record& rec,
+            const benchmark_format& fmt,
+            const bool& first
+        ) {
+            switch(fmt) {
+                case benchmark_format::json:         return format_json(rec);
+                case benchmark_format::csv:          return format_csv(rec, first);
+                case benchmark_format::chrome_trace: return format_trace(rec, first);
+                default:                             return format_text(rec);
+            }
+        };
+
+        /*!
+         * \brief Get the id of the calling thread.
+         * Uses the kernel thread id on Linux to match other tools.
+         * \return Thread id.
+         */
+        static std::uint64_t thread_id(void) {
+#if defined(__linux__)
+            return static_cast<std::uint64_t>(syscall(SYS_gettid));
+#else
+            return static_cast<std::uint64_t>(std::hash<std::thread::id>{}(std::this_thread::get_id()));
+#endif
+        };
+
+        /*!
+         * \brief Get the id of this process.
+         * \return Process id.
+         */
+        static std::uint64_t process_id(void) {
+#if defined(__linux__)
+            return static_cast<std::uint64_t>(getpid());
+#else
+            return 0;
+#endif
+        };
+
+        /*!
+         * \brief Escape a string for use in JSON.
+         * \param str String to escape.
+         * \return Escaped string, without quotes.
+         */
+        static std::string json_escape(const std::string& str) {
+            std::string res;
+            res.reserve(str.size());
+            for(const char& c : str) {
+                switch(c) {
+                    case '"':  res += "\\\""; break;
+                    case '\\': res += "\\\\"; break;
+                    case '\n': res += "\\n";  break;
+                    case '\r': res += "\\r";  break;
+                    case '\t': res += "\\t";  break;
+                    default:
+                        if(static_cast<unsigned char>(c) < 0x20) {
+                            char buf[8];
+                            std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+                            res += buf;
+                        } else res += c;
+                }
+            }
+            return res;
+        };
+
+        /*!
+         * \brief Escape a string for use in CSV.
+         * \param str String to escape.
+         * \return Quoted string if needed.
+         */
+        static std::string csv_escape(const std::string& str) {
+            if(str.find_first_of(",\"\n\r") == std::string::npos) return str;
+            std::string res = "\"";
+            for(const char& c : str) {
+                if(c == '"') res += '"';
+                res += c;
+            }
+            return res + "\"";
+        };
+
+        /*!
+         * \brief Get a processing rate.
+         * \param amount Amount processed.
+         * \param elapsed_ns Time taken in nanoseconds.
+         * \return Amount per second, zero if no time elapsed.
+         */
+        static double per_second(const std::uint64_t& amount, const std::int64_t& elapsed_ns) {
+            if(elapsed_ns <= 0) return 0.0;
+            return static_cast<double>(amount) * 1e9 / static_cast<double>(elapsed_ns);
+        };
+
+        /*!
+         * \brief Format a rate with a scaled SI prefix, eg "512.30 MB/s".
+         * \param rate Amount per second.
+         * \param unit Unit name, eg "B" or "items".
+         * \return Formatted rate.
+         */
+        static std::string format_rate(double rate, const std::string& unit) {
+            static const char* prefixes[] = { "", "k", "M", "G", "T", "P" };
+            std::size_t p = 0;
+            while(rate >= 1000.0 && p < 5) {
+                rate /= 1000.0;
+                p++;
+            }
+            char buf[32];
+            std::snprintf(buf, sizeof(buf), "%.*f ", (p == 0 ? 0 : 2), rate);
+            //  Word units read better with a space after the prefix, eg "1.20 M items/s".
+            if(unit.size() > 1 && p > 0) return std::string(buf) + prefixes[p] + " " + unit + "/s";
+            return std::string(buf) + prefixes[p] + unit + "/s";
+        };
+
+        /*!
+         * \brief Format a time in the benchmark's unit.
+         * Whole values print as integers, fractions to 15 significant digits.
+         * \param value Time value.
+         * \return Formatted value.
+         */
+        static std::string format_duration(const double& value) {
+            char buf[32];
+            std::snprintf(buf, sizeof(buf), "%.15g", value);
+            return buf;
+        };
+
+        /*!
+         * \brief Format a value for JSON at full double precision.
+         * \param value Value.
+         * \return Formatted value, null if not finite.
+         */
+        static std::string json_number(const double& value) {
+            if(!std::isfinite(value)) return "null";
+            char buf[32];
+            std::snprintf(buf, sizeof(buf), "%.17g", value);
+            return buf;
+        };
+
+        /*!
+         * \brief Convert a time point to nanoseconds since the epoch.
+         * \param tp Time point.
+         * \return Nanoseconds since the epoch.
+         */
+        static std::int64_t epoch_ns(const std::chrono::system_clock::time_point& tp) {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(tp.time_since_epoch()).count();
+        };
+
+    private:
+        benchmark_output() {
+            const char* env = std::getenv("WTF_BENCHMARK_FORMAT");
+            if(env == nullptr) return;
+            const std::string fmt = env;
+            if(fmt == "json") format = benchmark_format::json;
+            if(fmt == "csv") format = benchmark_format::csv;
+            if(fmt == "chrome") format = benchmark_format::chrome_trace;
+        };
+        ~benchmark_output() = default;
+
+        //  Open the default log file if no sink is set.  Call with the lock held.
+        //  The default log file depends on the format.
+        void open_default_sink(const benchmark_format& fmt) {
+            if(sink && !(default_sink && fmt != sink_format)) return;
+            if(sink) sink->flush();
+            sink = std::make_shared<file_sink>(file_name(fmt));
+            sink_format = fmt;
+            default_sink = true;
+        };
+
+        static std::string file_name(const benchmark_format& fmt) {
+            const char* env = std::getenv("WTF_BENCHMARK_LOG");
+            if(env != nullptr && *env != '\0') return env;
+            switch(fmt) {
+                case benchmark_format::json:         return "benchmark/log.jsonl";
+                case benchmark_format::csv:          return "benchmark/log.csv";
+                case benchmark_format::chrome_trace: return "benchmark/trace.json";
+                default:                             return "benchmark/log.txt";
+            }
+        };
+
+        static std::string format_text(const benchmark_record& rec) {
+            std::ostringstream out;
+            if(rec.depth > 0) {
+                out << std::string(rec.depth * 2, ' ') << rec.name << ":  " << format_duration(rec.elapsed) << " " << rec.unit;
+                if(rec.children > 0) out << " (self " << format_duration(rec.self) << " " << rec.unit << ")";
+                out << std::endl;
+                return out.str();
+            }
+            const std::time_t start_time = std::chrono::system_clock::to_time_t(rec.start);
+            const std::time_t end_time = std::chrono::system_clock::to_time_t(rec.end);
+            out << "Benchmark:  " << rec.label << std::endl;
+            out << "Started at:  " << std::ctime(&start_time);
+            out << "Completed at:  " << std::ctime(&end_time);
+            if(rec.elapsed_ns == 0 && !rec.metrics.empty()) {
+                //  Metric only records, eg gauges and baselines.
+                for(auto& m : rec.metrics) out << m.first << ":  " << m.second << std::endl;
+                return out.str();
+            }
+            if(rec.elapsed_ns == 0) {
+                out << "Internal clock did not tick during benchmark";
+            } else {
+                out << "Total time:  " << format_duration(rec.elapsed) << " " << rec.unit;
+                if(rec.children > 0) out << std::endl << "Self time:  " << format_duration(rec.self) << " " << rec.unit;
+                if(rec.bytes > 0)
+                    out << std::endl << "Throughput:  " << format_rate(per_second(rec.bytes, rec.elapsed_ns), "B");
+                if(rec.items > 0)
+                    out << std::endl << "Item rate:  " << format_rate(per_second(rec.items, rec.elapsed_ns), "items");
+            }
+            if(rec.has_counters) {
+                if(!rec.counters.available()) out << std::endl << "Hardware counters unavailable";
+                for(std::size_t i = 0; i < perf_sample::event_count; i++) {
+                    const auto ev = static_cast<perf_sample::event>(i);
+                    if(!rec.counters.valid[ev]) continue;
+                    out << std::endl << perf_sample::name(ev) << ":  " << rec.counters.values[ev];
+                    if(rec.iterations > 1)
+                        out << " (" << rec.counters.per_iteration(ev, rec.iterations) << " per iteration)";
+                }
+                if(rec.counters.valid[perf_sample::cycles] && rec.counters.valid[perf_sample::instructions])
+                    out << std::endl << "IPC:  " << rec.counters.ipc();
+            }
+            if(rec.has_allocs) {
+                if(!alloc_tracker::linked()) out << std::endl << "Allocation tracking not linked";
+                else out << std::endl << "Allocations:  " << rec.allocs.allocations << " (" << rec.allocs.bytes <<
+                    " bytes), frees:  " << rec.allocs.deallocations << ", peak live:  " << rec.allocs.peak << " bytes";
+            }
+            if(rec.has_cpu) {
+                if(!rec.cpu.available) out << std::endl << "CPU usage unavailable";
+                else out << std::endl << "CPU time:  " << rec.cpu.cpu_ns << " ns (" <<
+                    rec.cpu.cpu_percent(rec.elapsed_ns) << "% of wall), off CPU:  " <<
+                    rec.cpu.off_cpu_ns(rec.elapsed_ns) << " ns" <<
+                    std::endl << "Context switches:  " << rec.cpu.voluntary_switches << " voluntary, " <<
+                    rec.cpu.involuntary_switches << " involuntary" <<
+                    std::endl << "Page faults:  " << rec.cpu.minor_faults << " minor, " <<
+                    rec.cpu.major_faults << " major";
+            }
+            for(auto& m : rec.metrics) out << std::endl << m.first << ":  " << m.second;
+            out << std::endl;
+            return out.str();
+        };
+
+        static std::string format_json(const benchmark_record& rec) {
+            std::ostringstream out;
+            out << "{\"label\":\"" << json_escape(rec.label) << "\"" <<
+                ",\"start_ns\":" << epoch_ns(rec.start) <<
+                ",\"end_ns\":" << epoch_ns(rec.end) <<
+                ",\"elapsed_ns\":" << rec.elapsed_ns <<
+                ",\"elapsed\":" << format_duration(rec.elapsed) <<
+                ",\"unit\":\"" << rec.unit << "\"" <<
+                ",\"type\":\"" << rec.type << "\"" <<
+                ",\"pid\":" << process_id() <<
+                ",\"tid\":" << rec.thread_id <<
+                ",\"iterations\":" << rec.iterations;
+            if(rec.bytes > 0)
+                out << ",\"bytes\":" << rec.bytes << ",\"bytes_per_second\":" << json_number(per_second(rec.bytes, rec.elapsed_ns));
+            if(rec.items > 0)
+                out << ",\"items\":" << rec.items << ",\"items_per_second\":" << json_number(per_second(rec.items, rec.elapsed_ns));
+            if(rec.depth > 0 || rec.children > 0) {
+                out << ",\"name\":\"" << json_escape(rec.name) << "\"" <<
+                    ",\"depth\":" << rec.depth <<
+                    ",\"span_id\":" << rec.span_id <<
+                    ",\"parent_id\":" << rec.parent_id <<
+                    ",\"self_ns\":" << rec.self_ns;
+            }
+            if(rec.has_counters && rec.counters.available()) {
+                out << ",\"counters\":{";
+                bool first = true;
+                for(std::size_t i = 0; i < perf_sample::event_count; i++) {
+                    const auto ev = static_cast<perf_sample::event>(i);
+                    if(!rec.counters.valid[ev]) continue;
+                    out << (first ? "" : ",") << "\"" << perf_sample::name(ev) << "\":" << rec.counters.values[ev];
+                    first = false;
+                }
+                out << "}";
+                if(rec.counters.valid[perf_sample::cycles] && rec.counters.valid[perf_sample::instructions])
+                    out << ",\"ipc\":" << json_number(rec.counters.ipc());
+            }
+            if(rec.has_allocs && alloc_tracker::linked()) {
+                out << ",\"allocations\":" << rec.allocs.allocations <<
+                    ",\"alloc_bytes\":" << rec.allocs.bytes <<
+                    ",\"frees\":" << rec.allocs.deallocations <<
+                    ",\"peak_live_bytes\":" << rec.allocs.peak;
+            }
+            if(rec.has_cpu && rec.cpu.available) {
+                out << ",\"cpu_ns\":" << rec.cpu.cpu_ns <<
+                    ",\"off_cpu_ns\":" << rec.cpu.off_cpu_ns(rec.elapsed_ns) <<
+                    ",\"voluntary_switches\":" << rec.cpu.voluntary_switches <<
+                    ",\"involuntary_switches\":" << rec.cpu.involuntary_switches <<
+                    ",\"minor_faults\":" << rec.cpu.minor_faults <<
+                    ",\"major_faults\":" << rec.cpu.major_faults;
+            }
+            for(auto& m : rec.metrics) out << ",\"" << json_escape(m.first) << "\":" << json_number(m.second);
+            out << "}\n";
+            return out.str();
+        };
+
+        static std::string format_csv(const benchmark_record& rec, const bool& first) {
+            std::ostringstream out;
+            if(first) {
+                out << "label,start_ns,end_ns,elapsed_ns,pid,tid,iterations";
+                for(std::size_t i = 0; i < perf_sample::event_count; i++)
+                    out << "," << perf_sample::name(static_cast<perf_sample::event>(i));
+                out << ",depth,span_id,parent_id,self_ns,bytes,items,bytes_per_second,items_per_second" <<
+                    ",allocations,alloc_bytes,frees,peak_live_bytes" <<
+                    ",cpu_ns,off_cpu_ns,voluntary_switches,involuntary_switches,minor_faults,major_faults,metrics,type\n";
+            }
+            out << csv_escape(rec.label) << "," << epoch_ns(rec.start) << "," << epoch_ns(rec.end) << "," <<
+                rec.elapsed_ns << "," << process_id() << "," << rec.thread_id << "," << rec.iterations;
+            //  Counters that were not read are left empty.
+            for(std::size_t i = 0; i < perf_sample::event_count; i++) {
+                out << ",";
+                if(rec.has_counters && rec.counters.valid[i]) out << rec.counters.values[i];
+            }
+            out << "," << rec.depth << "," << rec.span_id << "," << rec.parent_id << "," << rec.self_ns <<
+                "," << rec.bytes << "," << rec.items << "," << per_second(rec.bytes, rec.elapsed_ns) <<
+                "," << per_second(rec.items, rec.elapsed_ns);
+            //  Allocation columns are left empty if not tracked.
+            if(rec.has_allocs && alloc_tracker::linked())
+                out << "," << rec.allocs.allocations << "," << rec.allocs.bytes << "," <<
+                    rec.allocs.deallocations << "," << rec.allocs.peak;
+            else out << ",,,,";
+            //  CPU usage columns are left empty if not measured.
+            if(rec.has_cpu && rec.cpu.available)
+                out << "," << rec.cpu.cpu_ns << "," << rec.cpu.off_cpu_ns(rec.elapsed_ns) << "," <<
+                    rec.cpu.voluntary_switches << "," << rec.cpu.involuntary_switches << "," <<
+                    rec.cpu.minor_faults << "," << rec.cpu.major_faults;
+            else out << ",,,,,,";
+            //  Extra metrics share one column as name=value pairs.
+            std::string metrics;
+            for(auto& m : rec.metrics)
+                metrics += (metrics.empty() ? "" : ";") + m.first + "=" + std::to_string(m.second);
+            out << "," << csv_escape(metrics) << "," << rec.type << "\n";
+            return out.str();
+        };
+
+        static std::string format_trace(const benchmark_record& rec, const bool& first) {
+            std::ostringstream out;
+            if(first) out << "[\n";
+            //  Trace event timestamps are in microseconds.
+            out.precision(3);
+            out << std::fixed << "{\"name\":\"" << json_escape(rec.name.empty() ? rec.label : rec.name) << "\"" <<
+                ",\"cat\":\"benchmark\",\"ph\":\"X\"" <<
+                ",\"ts\":" << static_cast<double>(epoch_ns(rec.start)) / 1000.0 <<
+                ",\"dur\":" << static_cast<double>(rec.elapsed_ns) / 1000.0 <<
+                ",\"pid\":" << process_id() <<
+                ",\"tid\":" << rec.thread_id <<
+                ",\"args\":{\"iterations\":" << rec.iterations <<
+                ",\"self_us\":" << static_cast<double>(rec.self_ns) / 1000.0;
+            if(rec.bytes > 0) out << ",\"bytes_per_second\":" << json_number(per_second(rec.bytes, rec.elapsed_ns));
+            if(rec.items > 0) out << ",\"items_per_second\":" << json_number(per_second(rec.items, rec.elapsed_ns));
+            if(rec.has_counters) {
+                for(std::size_t i = 0; i < perf_sample::event_count; i++) {
+                    const auto ev = static_cast<perf_sample::event>(i);
+                    if(rec.counters.valid[ev])
+                        out << ",\"" << perf_sample::name(ev) << "\":" << rec.counters.values[ev];
+                }
+            }
+            if(rec.has_allocs && alloc_tracker::linked())
+                out << ",\"allocations\":" << rec.allocs.allocations << ",\"alloc_bytes\":" << rec.allocs.bytes <<
+                    ",\"peak_live_bytes\":" << rec.allocs.peak;
+            if(rec.has_cpu && rec.cpu.available)
+                out << ",\"cpu_us\":" << static_cast<double>(rec.cpu.cpu_ns) / 1000.0 <<
+                    ",\"off_cpu_us\":" << static_cast<double>(rec.cpu.off_cpu_ns(rec.elapsed_ns)) / 1000.0 <<
+                    ",\"voluntary_switches\":" << rec.cpu.voluntary_switches <<
+                    ",\"involuntary_switches\":" << rec.cpu.involuntary_switches <<
+                    ",\"major_faults\":" << rec.cpu.major_faults;
+            for(auto& m : rec.metrics) out << ",\"" << json_escape(m.first) << "\":" << json_number(m.second);
+            out << "}},\n";
+            return out.str();
+        };
+
+        std::mutex output_mtx;  //  Thread safety for logging
+        std::atomic<benchmark_format> format {benchmark_format::text};
+        std::shared_ptr<benchmark_sink> sink;     //  Current destination, created on first write
+        bool default_sink = true;                 //  True if using the default log file
+        benchmark_format sink_format = benchmark_format::text;  //  Format the default log file was opened for
+};
+
+}  //  end namespace wtf
+
+#endif
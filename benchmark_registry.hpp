@@ -0,0 +1,467 @@
+/*
+ * Benchmark Registry
+ * By:  Matthew Evans
+ * File:  benchmark_registry.hpp
+ * Version:  101826
+ *
+ * See LICENSE.md for copyright information.
+ *
+ * Register parameterized benchmark families and run them from one main.
+ * Each family expands to one benchmark per argument combination, logged
+ * under a derived label such as "md5_update/1024".
+ *
+ * Command line options for run_benchmarks():
+ *   --filter=REGEX      Only run benchmarks whose label matches
+ *   --repetitions=N     Run each benchmark N times
+ *   --format=FORMAT     text, json, csv or chrome
+ *   --list              Print labels without running
+ *   --cpu=N             Pin the benchmark thread to CPU N
+ *   --priority          Raise the benchmark thread's scheduling priority
+ *   --baseline          Log cache and memory baselines first, see memory_baseline.hpp
+ *
+ * Families set up with threads() run as a scaling benchmark instead, see
+ * benchmark_scaling.hpp.  The function runs on every thread and reads
+ * thread_index and thread_count from the state to split its work.
+ *
+ * Before running, the system state is checked for noise sources (frequency
+ * scaling, turbo, SMT siblings, load), warnings are printed to stderr and
+ * the state is written to the log as metadata, along with the measured cost
+ * and resolution of each clock from timer_calibration.hpp.
+ *
+ * Example:
+ *
+ * void md5_update(wtf::benchmark_state& state) {
+ *     std::vector<unsigned char> buffer(state.arg(0));
+ *     wtf::md5_hasher hasher;
+ *     hasher.initialize();
+ *     for(std::uint64_t i = 0; i < state.iterations; i++) hasher.update(buffer.data(), buffer.size());
+ *     state.set_bytes(state.iterations * buffer.size());
+ * }
+ * WTF_BENCHMARK(md5_update).range(64, 1 << 16, 4).iterations(1000);
+ * WTF_BENCHMARK_MAIN();
+ *
+ */
+
+#ifndef WTF_BENCHMARK_REGISTRY_HPP
+#define WTF_BENCHMARK_REGISTRY_HPP
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <regex>
+#include <iostream>
+#include <functional>
+#include <cstdint>
+#include <charconv>
+#include <stdexcept>
+
+#include "benchmark.hpp"
+#include "benchmark_environment.hpp"
+#include "benchmark_scaling.hpp"
+#include "memory_baseline.hpp"
+#include "timer_calibration.hpp"
+
+namespace wtf {
+
+/*!
+ * \class benchmark_state
+ * \brief Arguments and settings passed to a registered benchmark.
+ */
+class benchmark_state {
+    public:
+        /*!
+         * \brief Create the state for one run.
+         * \param a Arguments for this run.
+         * \param iters Iterations the benchmark should perform.
+         * \param index Index of the calling thread in a scaling run.
+         * \param count Number of threads in a scaling run.
+         */
+        benchmark_state(
+            const std::vector<std::int64_t>& a,
+            const std::uint64_t& iters,
+            const std::size_t& index = 0,
+            const std::size_t& count = 1
+        ) : args(a), iterations(iters), thread_index(index), thread_count(count) {};
+
+        benchmark_state() = delete;  //!<  Delete default constructor.
+
+        /*!
+         * \brief Get an argument.
+         * \param idx Argument index.
+         * \return Argument value.
+         * \throws std::out_of_range if there is no such argument.
+         */
+        std::int64_t arg(const std::size_t& idx) const {
+            if(idx >= args.size()) throw std::out_of_range("Invalid benchmark argument.");
+            return args[idx];
+        };
+
+        /*!
+         * \brief Set the number of bytes processed by this run.
+         * \param count Byte count.
+         */
+        void set_bytes(const std::uint64_t& count) { bytes = count; };
+
+        /*!
+         * \brief Set the number of items processed by this run.
+         * \param count Item count.
+         */
+        void set_items(const std::uint64_t& count) { items = count; };
+
+        const std::vector<std::int64_t> args;  //!<  Arguments for this run.
+        const std::uint64_t iterations;        //!<  Iterations to perform.
+        const std::size_t thread_index;        //!<  Index of this thread, zero if not a scaling run.
+        const std::size_t thread_count;        //!<  Threads running the benchmark.
+        std::uint64_t bytes = 0;               //!<  Bytes processed.
+        std::uint64_t items = 0;               //!<  Items processed.
+};
+
+//!  Signature of a registered benchmark.
+using benchmark_function = std::function<void(benchmark_state&)>;
+
+/*!
+ * \class benchmark_family
+ * \brief A benchmark and the argument sets to run it with.
+ * Argument setters append combinations and return the family for chaining.
+ */
+class benchmark_family {
+    public:
+        /*!
+         * \brief Create a family.
+         * \param n Family name.
+         * \param fn Benchmark function.
+         */
+        benchmark_family(const std::string& n, const benchmark_function& fn) : name(n), function(fn) {};
+
+        benchmark_family() = delete;  //!<  Delete default constructor.
+
+        /*!
+         * \brief Add a run with one argument.
+         */
+        benchmark_family& arg(const std::int64_t& a) { arg_sets.push_back({ a }); return *this; };
+
+        /*!
+         * \brief Add a run with several arguments.
+         */
+        benchmark_family& args(const std::vector<std::int64_t>& a) { arg_sets.push_back(a); return *this; };
+
+        /*!
+         * \brief Add runs for lo, lo * mult, lo * mult^2 ... up to and including hi.
+         * \throws std::invalid_argument if mult is below 2 or lo is above hi.
+         */
+        benchmark_family& range(const std::int64_t& lo, const std::int64_t& hi, const std::int64_t& mult = 8) {
+            for(auto& v : expand_range(lo, hi, mult)) arg_sets.push_back({ v });
+            return *this;
+        };
+
+        /*!
+         * \brief Add runs for every value from lo to hi by step.
+         */
+        benchmark_family& dense_range(const std::int64_t& lo, const std::int64_t& hi, const std::int64_t& step = 1) {
+            if(step <= 0) throw std::invalid_argument("Benchmark range step must be positive.");
+            for(std::int64_t v = lo; v <= hi; v += step) {
+                arg_sets.push_back({ v });
+                //  Next value passes hi, or would overflow
+                if(static_cast<std::uint64_t>(hi) - static_cast<std::uint64_t>(v) < static_cast<std::uint64_t>(step)) break;
+            }
+            return *this;
+        };
+
+        /*!
+         * \brief Add runs for the cartesian product of several multiplicative ranges.
+         * \param bounds Low and high bound for each argument.
+         * \param mult Multiplier for every range.
+         */
+        benchmark_family& ranges(
+            const std::vector<std::pair<std::int64_t, std::int64_t>>& bounds,
+            const std::int64_t& mult = 8
+        ) {
+            std::vector<std::vector<std::int64_t>> lists;
+            for(auto& b : bounds) lists.push_back(expand_range(b.first, b.second, mult));
+            return arg_product(lists);
+        };
+
+        /*!
+         * \brief Add runs for the cartesian product of argument lists.
+         * \param lists Values for each argument.
+         */
+        benchmark_family& arg_product(const std::vector<std::vector<std::int64_t>>& lists) {
+            if(lists.empty()) return *this;
+            std::vector<std::vector<std::int64_t>> res = { {} };
+            for(auto& list : lists) {
+                std::vector<std::vector<std::int64_t>> next;
+                for(auto& prefix : res) {
+                    for(auto& v : list) {
+                        next.push_back(prefix);
+                        next.back().push_back(v);
+                    }
+                }
+                res.swap(next);
+            }
+            arg_sets.insert(arg_sets.end(), res.begin(), res.end());
+            return *this;
+        };
+
+        /*!
+         * \brief Set the iterations passed to the benchmark.
+         */
+        benchmark_family& iterations(const std::uint64_t& n) { iteration_count = n; return *this; };
+
+        /*!
+         * \brief Run as a scaling benchmark at 1, 2, 4 ... max threads.
+         * \param max Highest thread count, zero for the hardware thread count.
+         * \param mode Strong scaling splits work between threads, weak gives each the same.
+         */
+        benchmark_family& threads(const std::size_t& max, const scaling_mode& mode = scaling_mode::strong) {
+            scaling = true;
+            max_threads = max;
+            thread_mode = mode;
+            return *this;
+        };
+
+        /*!
+         * \brief Set how many times each combination is run.
+         */
+        benchmark_family& repetitions(const std::size_t& n) { repetition_count = n; return *this; };
+
+        /*!
+         * \brief Get the label for an argument set.
+         * \param a Arguments.
+         * \return Family name followed by each argument, separated by '/'.
+         */
+        std::string label(const std::vector<std::int64_t>& a) const {
+            std::string res = name;
+            for(auto& v : a) res += "/" + std::to_string(v);
+            return res;
+        };
+
+        /*!
+         * \brief Get every argument set.  A family with none runs once without arguments.
+         * \return Argument sets.
+         */
+        std::vector<std::vector<std::int64_t>> combinations(void) const {
+            if(arg_sets.empty()) return { {} };
+            return arg_sets;
+        };
+
+        const std::string name;                 //!<  Family name.
+        const benchmark_function function;      //!<  Benchmark function.
+        std::uint64_t iteration_count = 1;      //!<  Iterations passed to each run.
+        std::size_t repetition_count = 1;       //!<  Runs per combination.
+        bool scaling = false;                   //!<  True to run as a scaling benchmark.
+        std::size_t max_threads = 0;            //!<  Highest thread count for scaling runs.
+        scaling_mode thread_mode = scaling_mode::strong;  //!<  Scaling mode.
+
+    private:
+        static std::vector<std::int64_t> expand_range(
+            const std::int64_t& lo,
+            const std::int64_t& hi,
+            const std::int64_t& mult
+        ) {
+            if(mult < 2) throw std::invalid_argument("Benchmark range multiplier must be at least 2.");
+            if(lo > hi) throw std::invalid_argument("Benchmark range low bound is above the high bound.");
+            std::vector<std::int64_t> res;
+            for(std::int64_t v = lo; v < hi; v *= mult) {
+                res.push_back(v);
+                if(v <= 0) break;          //  Would never reach hi
+                if(v > hi / mult) break;   //  Next value passes hi, or would overflow
+            }
+            res.push_back(hi);
+            return res;
+        };
+
+        std::vector<std::vector<std::int64_t>> arg_sets;  //  Argument combinations
+};
+
+/*!
+ * \class benchmark_registry
+ * \brief Process wide list of benchmark families.
+ */
+class benchmark_registry {
+    public:
+        /*!
+         * \brief Get the process wide registry.
+         */
+        static benchmark_registry& instance(void) {
+            static benchmark_registry registry;
+            return registry;
+        };
+
+        /*!
+         * \brief Register a family.
+         * \param name Family name.
+         * \param fn Benchmark function.
+         * \return The new family, for setting arguments.
+         */
+        benchmark_family& add(const std::string& name, const benchmark_function& fn) {
+            families.push_back(std::make_unique<benchmark_family>(name, fn));
+            return *families.back();
+        };
+
+        /*!
+         * \brief Run every benchmark whose label matches a filter.
+         * \param filter Regular expression searched for in each label.
+         * \param repetitions Runs per combination, zero to use each family's setting.
+         * \param list_only Print labels instead of running.
+         * \return Number of benchmarks run or listed.
+         */
+        std::size_t run(const std::string& filter, const std::size_t& repetitions, const bool& list_only) {
+            const std::regex pattern(filter);
+            std::size_t count = 0;
+            for(auto& family : families) {
+                for(auto& a : family->combinations()) {
+                    const std::string label = family->label(a);
+                    if(!std::regex_search(label, pattern)) continue;
+                    count++;
+                    if(list_only) {
+                        std::cout << label << std::endl;
+                        continue;
+                    }
+                    const std::size_t reps = repetitions == 0 ? family->repetition_count : repetitions;
+                    for(std::size_t r = 0; r < reps; r++) run_one(*family, label, a);
+                }
+            }
+            benchmark_output::instance().flush();
+            return count;
+        };
+
+    private:
+        benchmark_registry() = default;
+        ~benchmark_registry() = default;
+
+        static void run_one(
+            const benchmark_family& family,
+            const std::string& label,
+            const std::vector<std::int64_t>& a
+        ) {
+            if(family.scaling) {
+                run_scaling(label, family.max_threads, family.thread_mode,
+                    [&](std::size_t index, std::size_t count) {
+                        benchmark_state state(a, family.iteration_count, index, count);
+                        family.function(state);
+                    });
+                return;
+            }
+            benchmark_state state(a, family.iteration_count);
+            benchmark<> bench(label);
+            bench.start();
+            family.function(state);
+            bench.set_iterations(state.iterations);
+            bench.set_bytes(state.bytes);
+            bench.set_items(state.items);
+            bench.stop();
+        };
+
+        std::vector<std::unique_ptr<benchmark_family>> families;  //  Registered families
+};
+
+/*!
+ * \brief Register a benchmark family.
+ * \param name Family name.
+ * \param fn Benchmark function.
+ * \return The new family, for setting arguments.
+ */
+inline benchmark_family& register_benchmark(const std::string& name, const benchmark_function& fn) {
+    return benchmark_registry::instance().add(name, fn);
+};
+
+namespace detail {
+
+//  Parse a whole option value as a number.
+template <typename V>
+inline bool parse_option(const std::string& text, V& value) {
+    const char* end = text.data() + text.size();
+    const std::from_chars_result res = std::from_chars(text.data(), end, value);
+    return res.ec == std::errc() && res.ptr == end;
+};
+
+//  Print an option error and the usage, returning the exit code.
+inline int benchmark_usage(const std::string& error) {
+    std::cerr << error << std::endl <<
+        "Options:" << std::endl <<
+        "  --filter=REGEX      Only run benchmarks whose label matches" << std::endl <<
+        "  --repetitions=N     Run each benchmark N times" << std::endl <<
+        "  --format=FORMAT     text, json, csv or chrome" << std::endl <<
+        "  --list              Print labels without running" << std::endl <<
+        "  --cpu=N             Pin the benchmark thread to CPU N" << std::endl <<
+        "  --priority          Raise the benchmark thread's scheduling priority" << std::endl <<
+        "  --baseline          Log cache and memory baselines first" << std::endl;
+    return 1;
+};
+
+}  //  end namespace detail
+
+/*!
+ * \brief Run registered benchmarks using command line options.
+ * Unknown options and bad values print usage to stderr.
+ * \param argc Argument count from main.
+ * \param argv Arguments from main.
+ * \return Zero on success, one on bad options.
+ */
+inline int run_benchmarks(int argc, char* argv[]) {
+    std::string filter = ".*";
+    std::size_t repetitions = 0;
+    bool list_only = false;
+    bool priority = false;
+    bool baseline = false;
+    int cpu = -1;
+    for(int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        if(arg.rfind("--filter=", 0) == 0) filter = arg.substr(9);
+        else if(arg.rfind("--repetitions=", 0) == 0) {
+            if(!detail::parse_option(arg.substr(14), repetitions) || repetitions == 0)
+                return detail::benchmark_usage("Invalid repetitions:  " + arg.substr(14));
+        }
+        else if(arg == "--list") list_only = true;
+        else if(arg.rfind("--cpu=", 0) == 0) {
+            if(!detail::parse_option(arg.substr(6), cpu) || cpu < 0)
+                return detail::benchmark_usage("Invalid CPU:  " + arg.substr(6));
+        }
+        else if(arg == "--priority") priority = true;
+        else if(arg == "--baseline") baseline = true;
+        else if(arg == "--format=text") benchmark_output::instance().set_format(benchmark_format::text);
+        else if(arg == "--format=json") benchmark_output::instance().set_format(benchmark_format::json);
+        else if(arg == "--format=csv") benchmark_output::instance().set_format(benchmark_format::csv);
+        else if(arg == "--format=chrome") benchmark_output::instance().set_format(benchmark_format::chrome_trace);
+        else return detail::benchmark_usage("Unknown option:  " + arg);
+    }
+    if(!list_only) {
+        if(!benchmark_enabled())
+            std::cerr << "Warning:  benchmark instrumentation is disabled, nothing will be timed" << std::endl;
+        if(cpu >= 0 && !pin_thread(cpu)) {
+            std::cerr << "Warning:  unable to pin to CPU " << cpu << std::endl;
+            cpu = -1;
+        }
+        if(priority && !raise_priority())
+            std::cerr << "Warning:  unable to raise priority" << std::endl;
+        const system_state state = read_system_state(cpu);
+        for(auto& w : state.warnings()) std::cerr << "Warning:  " << w << std::endl;
+        std::vector<std::pair<std::string, std::string>> meta = state.metadata();
+        for(auto& m : timer_calibration().metadata()) meta.push_back(m);
+        benchmark_output::instance().write_metadata(meta);
+        if(baseline) run_memory_baseline();
+    }
+    try {
+        benchmark_registry::instance().run(filter, repetitions, list_only);
+    } catch(const std::regex_error& e) {
+        std::cerr << "Invalid filter:  " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+};
+
+}  //  end namespace wtf
+
+#define WTF_BENCHMARK_CONCAT_(a, b) a##b
+#define WTF_BENCHMARK_CONCAT(a, b) WTF_BENCHMARK_CONCAT_(a, b)
+
+//!  Register a function as a benchmark family.  Chain argument setters after it.
+#define WTF_BENCHMARK(fn) \
+    static wtf::benchmark_family& WTF_BENCHMARK_CONCAT(wtf_benchmark_, __LINE__) = \
+        wtf::register_benchmark(#fn, fn)
+
+//!  Define main to run registered benchmarks.
+#define WTF_BENCHMARK_MAIN() \
+    int main(int argc, char* argv[]) { return wtf::run_benchmarks(argc, argv); }
+
+#endif
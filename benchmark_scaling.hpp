@@ -0,0 +1,182 @@
+/*
+ * Benchmark Scaling
+ * By:  Matthew Evans
+ * File:  benchmark_scaling.hpp
+ * Version:  101826
+ *
+ * See LICENSE.md for copyright information.
+ *
+ * Run a workload at 1, 2, 4 ... N threads and report how it scales.
+ * All threads wait on a barrier and start together.  Each thread count is
+ * logged as "label/threads:N" with speedup, efficiency and the spread of
+ * per thread times.
+ *
+ * Strong scaling splits a fixed amount of work between the threads, so
+ * speedup is T1 / TN.  Weak scaling gives each thread the same work, so
+ * speedup is N * T1 / TN.
+ *
+ * Times are taken from the moment the barrier opens, so thread creation is
+ * not counted.  Nothing is run when instrumentation is off, see
+ * benchmark_control.hpp.
+ *
+ * Example:
+ *
+ * wtf::run_scaling("md5 batch", 8, wtf::scaling_mode::strong,
+ *     [&](std::size_t index, std::size_t count) {
+ *         for(std::size_t i = index; i < files.size(); i += count) hash_file(files[i]);
+ *     });
+ *
+ */
+
+#ifndef WTF_BENCHMARK_SCALING_HPP
+#define WTF_BENCHMARK_SCALING_HPP
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <functional>
+
+#include "benchmark_control.hpp"
+#include "benchmark_output.hpp"
+
+namespace wtf {
+
+//!  How work is divided as threads are added.
+enum class scaling_mode { strong, weak };
+
+/*!
+ * \struct scaling_result
+ * \brief Results for one thread count.
+ */
+struct scaling_result {
+    std::size_t threads = 0;        //!<  Number of threads.
+    std::int64_t elapsed_ns = 0;    //!<  Wall time from release to the last thread finishing.
+    double speedup = 0.0;           //!<  Speedup over one thread.
+    double efficiency = 0.0;        //!<  Speedup divided by thread count.
+    double thread_mean_ns = 0.0;    //!<  Mean per thread time.
+    double thread_stddev_ns = 0.0;  //!<  Standard deviation of per thread times.
+};
+
+/*!
+ * \class start_barrier
+ * \brief Release a fixed number of threads at the same moment.
+ * Threads spin rather than sleep so they start as close together as possible.
+ */
+class start_barrier {
+    public:
+        /*!
+         * \brief Create the barrier.
+         * \param count Number of threads that must arrive.
+         */
+        start_barrier(const std::size_t& count) : expected(count) {};
+
+        start_barrier() = delete;  //!<  Delete default constructor.
+
+        /*!
+         * \brief Wait until every thread has arrived.
+         * \return Time the barrier opened, read by the last thread to arrive.
+         */
+        std::chrono::steady_clock::time_point arrive_and_wait(void) {
+            if(arrived.fetch_add(1, std::memory_order_acq_rel) + 1 == expected) {
+                opened = std::chrono::steady_clock::now();
+                released.store(true, std::memory_order_release);
+                return opened;
+            }
+            while(!released.load(std::memory_order_acquire)) std::this_thread::yield();
+            return opened;
+        };
+
+    private:
+        const std::size_t expected;          //  Threads to wait for
+        std::atomic<std::size_t> arrived {0};
+        std::atomic<bool> released {false};
+        std::chrono::steady_clock::time_point opened;  //  Written before released is set
+};
+
+/*!
+ * \brief Run a workload at increasing thread counts.
+ * \param label Benchmark label.
+ * \param max_threads Highest thread count.  Zero uses the hardware thread count.
+ * \param mode Strong or weak scaling, used to compute speedup.
+ * \param workload Called on each thread with its index and the thread count.
+ * \return Results for each thread count, empty if instrumentation is off.
+ */
+inline std::vector<scaling_result> run_scaling(
+    const std::string& label,
+    std::size_t max_threads,
+    const scaling_mode& mode,
+    const std::function<void(std::size_t, std::size_t)>& workload
+) {
+    if(!benchmark_enabled()) return {};
+    if(max_threads == 0) max_threads = std::thread::hardware_concurrency();
+    if(max_threads == 0) max_threads = 1;
+    std::vector<std::size_t> counts;
+    for(std::size_t n = 1; n < max_threads; n *= 2) counts.push_back(n);
+    counts.push_back(max_threads);
+
+    std::vector<scaling_result> results;
+    for(const std::size_t& n : counts) {
+        start_barrier barrier(n + 1);  //  Workers plus this thread
+        std::vector<std::chrono::steady_clock::time_point> finish(n);
+        std::vector<std::thread> workers;
+        for(std::size_t i = 0; i < n; i++) {
+            workers.emplace_back([&, i] {
+                barrier.arrive_and_wait();
+                workload(i, n);
+                finish[i] = std::chrono::steady_clock::now();
+            });
+        }
+        const std::chrono::steady_clock::time_point release = barrier.arrive_and_wait();
+        const auto wall_start = std::chrono::system_clock::now() - (std::chrono::steady_clock::now() - release);
+        for(auto& w : workers) w.join();
+
+        scaling_result res;
+        res.threads = n;
+        double sum = 0.0, sum_sq = 0.0;
+        for(auto& f : finish) {
+            const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(f - release).count();
+            if(ns > res.elapsed_ns) res.elapsed_ns = ns;
+            sum += static_cast<double>(ns);
+            sum_sq += static_cast<double>(ns) * static_cast<double>(ns);
+        }
+        res.thread_mean_ns = sum / static_cast<double>(n);
+        const double var = sum_sq / static_cast<double>(n) - res.thread_mean_ns * res.thread_mean_ns;
+        res.thread_stddev_ns = var > 0.0 ? std::sqrt(var) : 0.0;
+        const double base = results.empty() ? static_cast<double>(res.elapsed_ns) :
+                                              static_cast<double>(results.front().elapsed_ns);
+        if(res.elapsed_ns > 0) {
+            res.speedup = base / static_cast<double>(res.elapsed_ns);
+            if(mode == scaling_mode::weak) res.speedup *= static_cast<double>(n);
+        }
+        res.efficiency = res.speedup / static_cast<double>(n);
+        results.push_back(res);
+
+        benchmark_record rec;
+        rec.label = label + "/threads:" + std::to_string(n);
+        rec.name = rec.label;
+        rec.start = wall_start;
+        rec.end = wall_start + std::chrono::nanoseconds(res.elapsed_ns);
+        rec.elapsed_ns = res.elapsed_ns;
+        rec.elapsed = res.elapsed_ns;
+        rec.self_ns = res.elapsed_ns;
+        rec.self = res.elapsed_ns;
+        rec.unit = "nanoseconds";
+        rec.thread_id = benchmark_output::thread_id();
+        rec.metrics = {
+            { "threads", static_cast<double>(n) },
+            { "speedup", res.speedup },
+            { "efficiency", res.efficiency },
+            { "thread_mean_ns", res.thread_mean_ns },
+            { "thread_stddev_ns", res.thread_stddev_ns }
+        };
+        benchmark_output::instance().write(rec);
+    }
+    return results;
+};
+
+}  //  end namespace wtf
+
+#endif
@@ -0,0 +1,467 @@
+/*
+ * Benchmark Sinks
+ * By:  Matthew Evans
+ * File:  benchmark_sink.hpp
+ * Version:  101826
+ *
+ * See LICENSE.md for copyright information.
+ *
+ * Destinations for benchmark output.
+ *
+ *   file_sink      Appends to a file.  Keeps the file open and buffers writes.
+ *   rotating_file_sink
+ *                  Appends to a file from a logger thread, rotating it by
+ *                  size or age and compressing rotated files.
+ *   stderr_sink    Writes to standard error.
+ *   memory_sink    Keeps output in memory, useful for tests.
+ *   callback_sink  Passes output to a user function.
+ *
+ * Sinks are called with the output lock held, so they do not need to
+ * be thread safe themselves.
+ *
+ * Compressing rotated logs needs zlib.  Define WTF_BENCHMARK_ZLIB and link
+ * with -lz, otherwise rotated logs are kept uncompressed.
+ *
+ * Example:
+ *
+ * auto sink = std::make_shared<wtf::memory_sink>();
+ * wtf::benchmark_output::instance().set_sink(sink);
+ *   ~~~ run benchmarks ~~~
+ * std::string results = sink->str();
+ *
+ */
+
+#ifndef WTF_BENCHMARK_SINK_HPP
+#define WTF_BENCHMARK_SINK_HPP
+
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include <stdexcept>
+
+#if defined(WTF_BENCHMARK_ZLIB)
+#include <zlib.h>
+#endif
+
+namespace wtf {
+
+/*!
+ * \class benchmark_sink
+ * \brief Interface for benchmark output destinations.
+ */
+class benchmark_sink {
+    public:
+        virtual ~benchmark_sink() = default;  //!<  Default destructor.
+
+        /*!
+         * \brief Write formatted output.
+         * \param data Output to write.
+         */
+        virtual void write(const std::string& data) = 0;
+
+        /*!
+         * \brief Flush any buffered output.
+         */
+        virtual void flush(void) {};
+
+        /*!
+         * \brief Check if nothing has been written yet.
+         * Used to write headers once per destination.
+         * \return True if the destination is empty.
+         */
+        virtual bool at_start(void) const = 0;
+};
+
+/*!
+ * \class file_sink
+ * \brief Append output to a file.
+ * Output is collected in a buffer and written once it fills, when
+ * flushed, or when the sink is destroyed.
+ */
+class file_sink final : public benchmark_sink {
+    public:
+        /*!
+         * \brief Open the file, creating any missing directories.
+         * \param path File to append to.
+         * \param buffer_size Bytes to buffer before writing.
+         * \throws std::runtime_error if the file can not be opened.
+         */
+        file_sink(const std::string& path, const std::size_t& buffer_size = 64 * 1024) :
+        file_path(path), buffer_limit(buffer_size) {
+            const std::filesystem::path parent = std::filesystem::path(path).parent_path();
+            std::error_code ec;
+            if(!parent.empty()) std::filesystem::create_directories(parent, ec);
+            file.open(path, std::ios::app | std::ios::binary);
+            if(!file.is_open()) throw std::runtime_error("Unable to open benchmark log:  " + path);
+            file.seekp(0, std::ios::end);
+            empty_file = (file.tellp() == 0);
+            buffer.reserve(buffer_limit);
+        };
+
+        file_sink() = delete;                   //!<  Delete default constructor.
+        ~file_sink() { flush(); };              //!<  Flush on destruction.
+
+        /*!
+         * \brief Buffer output, writing to the file once the buffer is full.
+         * \param data Output to write.
+         */
+        void write(const std::string& data) override {
+            buffer += data;
+            empty_file = false;
+            if(buffer.size() >= buffer_limit) flush();
+        };
+
+        /*!
+         * \brief Write buffered output to the file.
+         */
+        void flush(void) override {
+            if(buffer.empty()) return;
+            file.write(buffer.data(), buffer.size());
+            file.flush();
+            buffer.clear();
+        };
+
+        /*!
+         * \brief Check if the file was empty when opened and nothing has been written.
+         * \return True if empty.
+         */
+        bool at_start(void) const override { return empty_file; };
+
+        const std::string file_path;  //!<  Path of the file being written.
+
+    private:
+        std::ofstream file;         //  Open log file
+        std::string buffer;         //  Pending output
+        std::size_t buffer_limit;   //  Flush once the buffer reaches this size
+        bool empty_file;            //  True if nothing has been written to the file
+};
+
+/*!
+ * \class rotating_file_sink
+ * \brief Append output to a file, rotating and compressing old files.
+ * Writes only queue output.  A logger thread does all file work, so
+ * measurement threads never wait on the disk, rotation or compression.
+ *
+ * Rotated files are named path.1, path.2 ... with the newest at .1, and
+ * get a .gz suffix when compressed.  Files beyond the keep count are
+ * deleted.  Each new file starts with the format's header.
+ */
+class rotating_file_sink final : public benchmark_sink {
+    public:
+        /*!
+         * \brief Open the file, creating any missing directories, and start the logger thread.
+         * \param path File to append to.
+         * \param max_bytes Rotate once the file reaches this size, zero for no limit.
+         * \param max_age Rotate once the file is this old, zero for no limit.
+         * \param keep Number of rotated files to keep.
+         * \param compress True to gzip rotated files.  Needs WTF_BENCHMARK_ZLIB.
+         * \throws std::runtime_error if the file can not be opened.
+         */
+        rotating_file_sink(
+            const std::string& path,
+            const std::uint64_t& max_bytes = 64 * 1024 * 1024,
+            const std::chrono::seconds& max_age = std::chrono::seconds(0),
+            const std::size_t& keep = 5,
+            const bool& compress = true
+        ) : file_path(path), size_limit(max_bytes), age_limit(max_age), keep_count(keep),
+        compress_files(compress && zlib_available), segments(1) {
+            const std::filesystem::path parent = std::filesystem::path(path).parent_path();
+            std::error_code ec;
+            if(!parent.empty()) std::filesystem::create_directories(parent, ec);
+            file.open(path, std::ios::app | std::ios::binary);
+            if(!file.is_open()) throw std::runtime_error("Unable to open benchmark log:  " + path);
+            file.seekp(0, std::ios::end);
+            file_bytes = static_cast<std::uint64_t>(file.tellp());
+            empty_file = (file_bytes == 0);
+            opened = std::chrono::steady_clock::now();
+            logger = std::thread([this] { run_logger(); });
+        };
+
+        rotating_file_sink() = delete;  //!<  Delete default constructor.
+
+        //!  Write everything queued and stop the logger thread.
+        ~rotating_file_sink() {
+            {
+                std::lock_guard<std::mutex> lock(queue_mtx);
+                stopping = true;
+            }
+            queue_cv.notify_all();
+            logger.join();
+        };
+
+        rotating_file_sink(const rotating_file_sink&) = delete;
+        rotating_file_sink& operator=(const rotating_file_sink&) = delete;
+
+        /*!
+         * \brief Queue output for the logger thread.
+         * \param data Output to write.
+         */
+        void write(const std::string& data) override {
+            bool wake = false;
+            {
+                std::lock_guard<std::mutex> lock(queue_mtx);
+                if(rotate_next) {
+                    segments.emplace_back();
+                    file_bytes = 0;
+                    opened = std::chrono::steady_clock::now();
+                    rotate_next = false;
+                }
+                segments.back() += data;
+                file_bytes += data.size();
+                empty_file = false;
+                if(size_limit > 0 && file_bytes >= size_limit) rotate_next = true;
+                wake = segments.size() > 1 || segments.back().size() >= wake_size;
+            }
+            if(wake) queue_cv.notify_one();
+        };
+
+        /*!
+         * \brief Wait until the logger thread has written everything queued.
+         */
+        void flush(void) override {
+            std::unique_lock<std::mutex> lock(queue_mtx);
+            const std::uint64_t target = ++flush_requested;
+            queue_cv.notify_all();
+            flushed_cv.wait(lock, [&] { return flush_done >= target; });
+        };
+
+        /*!
+         * \brief Check if the next write starts a file.
+         * Also decides age based rotation, so a header is written to the new file.
+         * \return True if the next write goes to an empty file.
+         */
+        bool at_start(void) const override {
+            std::lock_guard<std::mutex> lock(queue_mtx);
+            if(age_limit.count() > 0 && !rotate_next && file_bytes > 0 &&
+               std::chrono::steady_clock::now() - opened >= age_limit)
+                rotate_next = true;
+            return empty_file || rotate_next;
+        };
+
+        const std::string file_path;  //!<  Path of the file being written.
+
+    private:
+        //  Logger thread.  Writes queued output, rotating between segments.
+        void run_logger(void) {
+            std::unique_lock<std::mutex> lock(queue_mtx);
+            while(true) {
+                queue_cv.wait_for(lock, std::chrono::seconds(1), [this] {
+                    return stopping || flush_requested > flush_done || segments.size() > 1 ||
+                           segments.back().size() >= wake_size;
+                });
+                std::vector<std::string> work(1);
+                work.swap(segments);
+                const std::uint64_t flush_target = flush_requested;
+                const bool stop = stopping;
+                lock.unlock();
+
+                for(std::size_t i = 0; i < work.size(); i++) {
+                    if(i > 0) rotate();
+                    if(file.is_open() && !work[i].empty()) file.write(work[i].data(), work[i].size());
+                }
+                file.flush();
+
+                lock.lock();
+                flush_done = flush_target;
+                flushed_cv.notify_all();
+                if(stop && segments.size() == 1 && segments.back().empty()) return;
+            }
+        };
+
+        //  Move the current file to path.1, shifting older files up.  Logger thread only.
+        //  Both plain and .gz names are shifted, since a file that failed to
+        //  compress stays plain and must not be overwritten.
+        void rotate(void) {
+            file.close();
+            std::error_code ec;
+            if(keep_count == 0) {
+                std::filesystem::remove(file_path, ec);
+            } else {
+                for(const char* ext : { "", ".gz" }) {
+                    std::filesystem::remove(numbered(keep_count) + ext, ec);
+                    for(std::size_t n = keep_count; n > 1; n--)
+                        std::filesystem::rename(numbered(n - 1) + ext, numbered(n) + ext, ec);
+                }
+                std::filesystem::rename(file_path, numbered(1), ec);
+                if(compress_files) compress(numbered(1));
+            }
+            file.open(file_path, std::ios::trunc | std::ios::binary);
+        };
+
+        std::string numbered(const std::size_t& n) const { return file_path + "." + std::to_string(n); };
+
+        //  Gzip a file and remove the original.  Kept as is if compression fails.
+        static void compress(const std::string& path) {
+#if defined(WTF_BENCHMARK_ZLIB)
+            std::ifstream in(path, std::ios::binary);
+            gzFile out = gzopen((path + ".gz").c_str(), "wb");
+            if(!in.is_open() || out == nullptr) {
+                if(out != nullptr) gzclose(out);
+                return;
+            }
+            std::vector<char> buf(64 * 1024);
+            bool ok = true;
+            while(ok && in) {
+                in.read(buf.data(), buf.size());
+                const std::streamsize got = in.gcount();
+                if(got > 0) ok = gzwrite(out, buf.data(), static_cast<unsigned int>(got)) == got;
+            }
+            ok = (gzclose(out) == Z_OK) && ok;
+            in.close();
+            std::error_code ec;
+            if(ok) std::filesystem::remove(path, ec);
+            else std::filesystem::remove(path + ".gz", ec);
+#else
+            (void)path;
+#endif
+        };
+
+        static constexpr std::size_t wake_size = 64 * 1024;  //  Queued bytes that wake the logger
+#if defined(WTF_BENCHMARK_ZLIB)
+        static constexpr bool zlib_available = true;
+#else
+        static constexpr bool zlib_available = false;
+#endif
+
+        const std::uint64_t size_limit;         //  Rotate at this size
+        const std::chrono::seconds age_limit;   //  Rotate at this age
+        const std::size_t keep_count;           //  Rotated files to keep
+        const bool compress_files;              //  Gzip rotated files
+        std::ofstream file;                     //  Open log file, logger thread only
+        std::thread logger;                     //  Logger thread
+
+        mutable std::mutex queue_mtx;           //  Guards everything below
+        std::condition_variable queue_cv;       //  Wakes the logger
+        std::condition_variable flushed_cv;     //  Signals flush completion
+        std::vector<std::string> segments;      //  Queued output, a new segment after each rotation
+        std::uint64_t file_bytes = 0;           //  Size of the current file including queued output
+        std::chrono::steady_clock::time_point opened;  //  When the current file was started
+        mutable bool rotate_next = false;       //  Start a new file on the next write
+        bool empty_file;                        //  True if nothing has been written to the file
+        std::uint64_t flush_requested = 0;
+        std::uint64_t flush_done = 0;
+        bool stopping = false;
+};
+
+/*!
+ * \class stderr_sink
+ * \brief Write output to standard error.
+ */
+class stderr_sink final : public benchmark_sink {
+    public:
+        /*!
+         * \brief Write output to standard error.
+         * \param data Output to write.
+         */
+        void write(const std::string& data) override {
+            std::cerr << data;
+            started = true;
+        };
+
+        /*!
+         * \brief Flush standard error.
+         */
+        void flush(void) override { std::cerr.flush(); };
+
+        /*!
+         * \brief Check if nothing has been written by this sink.
+         * \return True if nothing has been written.
+         */
+        bool at_start(void) const override { return !started; };
+
+    private:
+        bool started = false;  //  Set after the first write
+};
+
+/*!
+ * \class memory_sink
+ * \brief Keep output in memory.
+ * May be read from other threads while benchmarks are writing.
+ */
+class memory_sink final : public benchmark_sink {
+    public:
+        /*!
+         * \brief Append output to the buffer.
+         * \param data Output to write.
+         */
+        void write(const std::string& data) override {
+            std::lock_guard<std::mutex> lock(buffer_mtx);
+            buffer += data;
+        };
+
+        /*!
+         * \brief Check if the buffer is empty.
+         * \return True if empty.
+         */
+        bool at_start(void) const override {
+            std::lock_guard<std::mutex> lock(buffer_mtx);
+            return buffer.empty();
+        };
+
+        /*!
+         * \brief Get a copy of the buffer.
+         * \return Output written so far.
+         */
+        std::string str(void) const {
+            std::lock_guard<std::mutex> lock(buffer_mtx);
+            return buffer;
+        };
+
+        /*!
+         * \brief Clear the buffer.
+         */
+        void clear(void) {
+            std::lock_guard<std::mutex> lock(buffer_mtx);
+            buffer.clear();
+        };
+
+    private:
+        mutable std::mutex buffer_mtx;  //  Guards the buffer for readers
+        std::string buffer;             //  Output written so far
+};
+
+/*!
+ * \class callback_sink
+ * \brief Pass output to a user function.
+ */
+class callback_sink final : public benchmark_sink {
+    public:
+        /*!
+         * \brief Create the sink.
+         * \param cb Function called with each formatted record.
+         */
+        callback_sink(const std::function<void(const std::string&)>& cb) : callback(cb) {};
+
+        callback_sink() = delete;    //!<  Delete default constructor.
+
+        /*!
+         * \brief Pass output to the callback.
+         * \param data Output to write.
+         */
+        void write(const std::string& data) override {
+            callback(data);
+            started = true;
+        };
+
+        /*!
+         * \brief Check if the callback has been called.
+         * \return True if not yet called.
+         */
+        bool at_start(void) const override { return !started; };
+
+    private:
+        std::function<void(const std::string&)> callback;  //  User function
+        bool started = false;                              //  Set after the first write
+};
+
+}  //  end namespace wtf
+
+#endif
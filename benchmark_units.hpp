@@ -0,0 +1,174 @@
+/*
+ * Benchmark Units
+ * By:  Matthew Evans
+ * File:  benchmark_units.hpp
+ * Version:  101826
+ *
+ * See LICENSE.md for copyright information.
+ *
+ * Duration unit traits for the benchmark log.
+ * Any std::chrono::duration may be used as a benchmark unit, including
+ * floating point durations such as std::chrono::duration<double, std::milli>
+ * for fractional results.  Unit names are compile time constants, so no
+ * string is built when a record is made.
+ *
+ * Standard units are named, eg "microseconds".  Other periods are named by
+ * their ratio, eg "ticks of 1/60 s".
+ *
+ * Use auto_unit to pick the unit for each record when it is logged.  The
+ * largest of nanoseconds, microseconds, milliseconds or seconds that keeps
+ * the value at least one is used, as a floating point value.
+ *
+ * Example:
+ *
+ * wtf::benchmark<wtf::auto_unit> bench("md5");
+ * wtf::benchmark<std::chrono::duration<double, std::micro>> fine("md5 16 bytes");
+ * static_assert(wtf::unit_traits<std::chrono::hours>::valid);
+ *
+ */
+
+#ifndef WTF_BENCHMARK_UNITS_HPP
+#define WTF_BENCHMARK_UNITS_HPP
+
+#include <chrono>
+#include <ratio>
+#include <type_traits>
+#include <cstdint>
+
+namespace wtf {
+
+/*!
+ * \struct auto_unit
+ * \brief Benchmark unit chosen per record from the elapsed time.
+ */
+struct auto_unit {};
+
+namespace detail {
+
+constexpr std::size_t digit_count(std::intmax_t v) {
+    std::size_t n = 1;
+    while(v >= 10) {
+        v /= 10;
+        n++;
+    }
+    return n;
+};
+
+//  Name of a period with no standard name, built at compile time.
+template <typename P>
+struct ratio_label {
+    static constexpr char prefix[] = "ticks of ";
+    static constexpr char suffix[] = " s";
+    static constexpr std::size_t size = sizeof(prefix) - 1 + digit_count(P::num) +
+        (P::den == 1 ? 0 : 1 + digit_count(P::den)) + sizeof(suffix);
+
+    struct text { char data[size]; };
+
+    static constexpr text make(void) {
+        text res {};
+        std::size_t pos = 0;
+        for(std::size_t i = 0; i + 1 < sizeof(prefix); i++) res.data[pos++] = prefix[i];
+        pos += digit_count(P::num);
+        for(std::intmax_t v = P::num, i = 1; i <= static_cast<std::intmax_t>(digit_count(P::num)); i++, v /= 10)
+            res.data[pos - i] = static_cast<char>('0' + v % 10);
+        if(P::den != 1) {
+            res.data[pos++] = '/';
+            pos += digit_count(P::den);
+            for(std::intmax_t v = P::den, i = 1; i <= static_cast<std::intmax_t>(digit_count(P::den)); i++, v /= 10)
+                res.data[pos - i] = static_cast<char>('0' + v % 10);
+        }
+        for(std::size_t i = 0; i < sizeof(suffix); i++) res.data[pos++] = suffix[i];
+        return res;
+    };
+
+    static constexpr text value = make();
+};
+
+template <typename P>
+constexpr const char* period_label(void) {
+    if constexpr(std::is_same_v<P, std::nano>) return "nanoseconds";
+    else if constexpr(std::is_same_v<P, std::micro>) return "microseconds";
+    else if constexpr(std::is_same_v<P, std::milli>) return "milliseconds";
+    else if constexpr(std::is_same_v<P, std::ratio<1>>) return "seconds";
+    else if constexpr(std::is_same_v<P, std::ratio<60>>) return "minutes";
+    else if constexpr(std::is_same_v<P, std::ratio<3600>>) return "hours";
+    else if constexpr(std::is_same_v<P, std::ratio<86400>>) return "days";
+    else return ratio_label<P>::value.data;
+};
+
+}  //  end namespace detail
+
+/*!
+ * \struct unit_traits
+ * \brief Conversion and naming for a benchmark unit.
+ * Not valid for types that are not durations.
+ * \tparam T Unit type.
+ */
+template <typename T>
+struct unit_traits {
+    static constexpr bool valid = false;  //!<  False, T is not a supported unit.
+};
+
+/*!
+ * \struct unit_traits
+ * \brief Conversion and naming for a std::chrono::duration.
+ */
+template <typename R, typename P>
+struct unit_traits<std::chrono::duration<R, P>> {
+    static constexpr bool valid = std::is_arithmetic_v<R>;  //!<  True for numeric durations.
+
+    /*!
+     * \brief Get the unit name.
+     * \return Name, the same for every record.
+     */
+    static constexpr const char* label(const std::int64_t&) { return detail::period_label<P>(); };
+
+    /*!
+     * \brief Convert nanoseconds to this unit.
+     * Integer durations are truncated as with duration_cast.
+     * \param ns Nanoseconds.
+     * \return Value in this unit.
+     */
+    static constexpr double count(const std::int64_t& ns, const std::int64_t&) {
+        return static_cast<double>(
+            std::chrono::duration_cast<std::chrono::duration<R, P>>(std::chrono::nanoseconds(ns)).count());
+    };
+};
+
+/*!
+ * \struct unit_traits
+ * \brief Unit chosen per record, see auto_unit.
+ */
+template <>
+struct unit_traits<auto_unit> {
+    static constexpr bool valid = true;  //!<  Always valid.
+
+    /*!
+     * \brief Get the unit name for a record.
+     * \param reference_ns Elapsed time of the record.
+     * \return Name of the chosen unit.
+     */
+    static constexpr const char* label(const std::int64_t& reference_ns) {
+        const std::int64_t ns = reference_ns < 0 ? -reference_ns : reference_ns;
+        if(ns < 1000) return "nanoseconds";
+        if(ns < 1000000) return "microseconds";
+        if(ns < 1000000000) return "milliseconds";
+        return "seconds";
+    };
+
+    /*!
+     * \brief Convert nanoseconds to the unit chosen for a record.
+     * \param ns Nanoseconds.
+     * \param reference_ns Elapsed time of the record, used to choose the unit.
+     * \return Value in the chosen unit.
+     */
+    static constexpr double count(const std::int64_t& ns, const std::int64_t& reference_ns) {
+        const std::int64_t ref = reference_ns < 0 ? -reference_ns : reference_ns;
+        const double scale = ref < 1000 ? 1.0 : ref < 1000000 ? 1e3 : ref < 1000000000 ? 1e6 : 1e9;
+        return static_cast<double>(ns) / scale;
+    };
+};
+
+}  //  end namespace wtf
+
+#endif
@@ -0,0 +1,139 @@
+/*
+ * CPU Usage
+ * By:  Matthew Evans
+ * File:  cpu_usage.hpp
+ * Version:  101826
+ *
+ * See LICENSE.md for copyright information.
+ *
+ * Read CPU time, context switches and page faults for the calling thread.
+ * CPU time comes from CLOCK_THREAD_CPUTIME_ID and the rest from getrusage().
+ * Comparing CPU time to wall time shows how long a region spent off the CPU
+ * waiting on I/O, locks or the scheduler.
+ *
+ * A high voluntary switch count points to blocking, a high involuntary count
+ * to competition for the CPU.  Major faults needed disk I/O, minor faults
+ * did not.
+ *
+ * Uses RUSAGE_THREAD where available, falling back to RUSAGE_SELF which
+ * counts the whole process.  On other platforms nothing is available.
+ *
+ * Example:
+ *
+ * wtf::cpu_usage usage;
+ * usage.start();
+ *   ~~~ do something ~~~
+ * wtf::cpu_usage_sample sample = usage.stop();
+ * if(sample.available) std::cout << sample.off_cpu_ns(wall_ns) << " ns off CPU";
+ *
+ */
+
+#ifndef WTF_CPU_USAGE_HPP
+#define WTF_CPU_USAGE_HPP
+
+#include <cstdint>
+
+#if defined(__linux__)
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#endif
+
+namespace wtf {
+
+/*!
+ * \struct cpu_usage_sample
+ * \brief CPU time and scheduler counts for a measured region.
+ */
+struct cpu_usage_sample {
+    bool available = false;                  //!<  True if the values were read.
+    std::int64_t cpu_ns = 0;                 //!<  CPU time used by the thread.
+    std::int64_t voluntary_switches = 0;     //!<  Context switches from blocking.
+    std::int64_t involuntary_switches = 0;   //!<  Context switches from preemption.
+    std::int64_t minor_faults = 0;           //!<  Page faults served without I/O.
+    std::int64_t major_faults = 0;           //!<  Page faults needing I/O.
+
+    /*!
+     * \brief Time spent off the CPU.
+     * \param wall_ns Wall time of the region.
+     * \return Wall time less CPU time, zero if not available.
+     */
+    std::int64_t off_cpu_ns(const std::int64_t& wall_ns) const {
+        if(!available || wall_ns <= cpu_ns) return 0;
+        return wall_ns - cpu_ns;
+    };
+
+    /*!
+     * \brief CPU time as a percent of wall time.
+     * \param wall_ns Wall time of the region.
+     * \return Percent on CPU, zero if not available.
+     */
+    double cpu_percent(const std::int64_t& wall_ns) const {
+        if(!available || wall_ns <= 0) return 0.0;
+        return 100.0 * static_cast<double>(cpu_ns) / static_cast<double>(wall_ns);
+    };
+};
+
+/*!
+ * \class cpu_usage
+ * \brief Measure CPU usage of the calling thread.
+ * Call start() and stop() from the thread being measured.
+ */
+class cpu_usage {
+    public:
+        cpu_usage() = default;   //!<  Default constructor.
+        ~cpu_usage() = default;  //!<  Default destructor.
+
+        /*!
+         * \brief Read the starting values.
+         */
+        void start(void) { begin = read(); };
+
+        /*!
+         * \brief Read the ending values.
+         * \return Change since start().  Not available if either read failed.
+         */
+        cpu_usage_sample stop(void) const {
+            const cpu_usage_sample end = read();
+            cpu_usage_sample sample;
+            if(!begin.available || !end.available) return sample;
+            sample.available = true;
+            sample.cpu_ns = end.cpu_ns - begin.cpu_ns;
+            sample.voluntary_switches = end.voluntary_switches - begin.voluntary_switches;
+            sample.involuntary_switches = end.involuntary_switches - begin.involuntary_switches;
+            sample.minor_faults = end.minor_faults - begin.minor_faults;
+            sample.major_faults = end.major_faults - begin.major_faults;
+            return sample;
+        };
+
+        /*!
+         * \brief Read the current totals for the calling thread.
+         * \return Totals since the thread started.
+         */
+        static cpu_usage_sample read(void) {
+            cpu_usage_sample sample;
+#if defined(__linux__)
+            timespec ts;
+            if(clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0) return sample;
+            rusage usage;
+#if defined(RUSAGE_THREAD)
+            if(getrusage(RUSAGE_THREAD, &usage) != 0)
+#endif
+            if(getrusage(RUSAGE_SELF, &usage) != 0) return sample;
+            sample.available = true;
+            sample.cpu_ns = static_cast<std::int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+            sample.voluntary_switches = usage.ru_nvcsw;
+            sample.involuntary_switches = usage.ru_nivcsw;
+            sample.minor_faults = usage.ru_minflt;
+            sample.major_faults = usage.ru_majflt;
+#endif
+            return sample;
+        };
+
+    private:
+        cpu_usage_sample begin;  //  Totals at start()
+};
+
+}  //  end namespace wtf
+
+#endif
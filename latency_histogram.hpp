@@ -0,0 +1,407 @@
+/*
+ * Latency Histogram
+ * By:  Matthew Evans
+ * File:  latency_histogram.hpp
+ * Version:  101826
+ *
+ * See LICENSE.md for copyright information.
+ *
+ * HDR-style log-linear latency histograms keyed by benchmark label.
+ * Each thread records into its own fixed size histogram without locking.
+ * Histograms for a label are merged when read.  When a thread exits its
+ * histograms are handed to the next new thread recording the same label,
+ * so memory follows the peak number of recording threads, not the total.
+ *
+ * Bucket layout:  values below 2^sub_bucket_bits get their own bucket,
+ * above that each power of two is split into 2^(sub_bucket_bits - 1)
+ * linear sub-buckets.  Relative error is below 1 / 2^(sub_bucket_bits - 1).
+ *
+ * The latency_recorder drops values while instrumentation is off, see
+ * benchmark_control.hpp.
+ *
+ * Example:
+ *
+ * wtf::latency_recorder::instance().record("My Timer", elapsed_ns);
+ * wtf::latency_snapshot snap = wtf::latency_recorder::instance().snapshot("My Timer");
+ * std::uint64_t p99 = snap.percentile(99.0);
+ *
+ */
+
+#ifndef WTF_LATENCY_HISTOGRAM_HPP
+#define WTF_LATENCY_HISTOGRAM_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <limits>
+#include <cstdint>
+#include <ostream>
+#include <utility>
+
+#include "benchmark_control.hpp"
+
+namespace wtf {
+
+/*!
+ * \class latency_histogram
+ * \brief Fixed size log-linear histogram with a single writer.
+ * Writes use relaxed atomics so other threads may read at any time.
+ */
+class latency_histogram {
+    public:
+        //!  Sub-bucket bits.  Gives 128 sub-buckets per power of two (< 0.8% error).
+        static constexpr std::size_t sub_bucket_bits = 8;
+        //!  Largest trackable value is 2^max_value_bits - 1.  Larger values are clamped.
+        static constexpr std::size_t max_value_bits = 48;
+        //!  Total number of buckets.
+        static constexpr std::size_t bucket_count =
+            (max_value_bits - sub_bucket_bits + 2) << (sub_bucket_bits - 1);
+        //!  Largest trackable value.
+        static constexpr std::uint64_t max_value = (std::uint64_t(1) << max_value_bits) - 1;
+
+        latency_histogram() {
+            for(auto& c : counts) c.store(0, std::memory_order_relaxed);
+        };
+        ~latency_histogram() = default;  //!<  Default destructor.
+
+        latency_histogram(const latency_histogram&) = delete;
+        latency_histogram& operator=(const latency_histogram&) = delete;
+
+        /*!
+         * \brief Record a value.  Only the owning thread may call this.
+         * \param value Value to record, clamped to max_value.
+         */
+        inline void record(std::uint64_t value) noexcept {
+            if(value > max_value) value = max_value;
+            bump(counts[bucket_index(value)], 1);
+            bump(total, 1);
+            bump(sum, value);
+            if(value < min.load(std::memory_order_relaxed)) min.store(value, std::memory_order_relaxed);
+            if(value > max.load(std::memory_order_relaxed)) max.store(value, std::memory_order_relaxed);
+        };
+
+        /*!
+         * \brief Add every value recorded in another histogram.  Only the owning thread may call this.
+         * \param other Histogram to add, which may still be written by its owner.
+         */
+        void add(const latency_histogram& other) noexcept {
+            for(std::size_t i = 0; i < bucket_count; i++) {
+                const std::uint64_t count = other.counts[i].load(std::memory_order_relaxed);
+                if(count != 0) bump(counts[i], count);
+            }
+            bump(total, other.total.load(std::memory_order_relaxed));
+            bump(sum, other.sum.load(std::memory_order_relaxed));
+            const std::uint64_t lo = other.min.load(std::memory_order_relaxed);
+            const std::uint64_t hi = other.max.load(std::memory_order_relaxed);
+            if(lo < min.load(std::memory_order_relaxed)) min.store(lo, std::memory_order_relaxed);
+            if(hi > max.load(std::memory_order_relaxed)) max.store(hi, std::memory_order_relaxed);
+        };
+
+        /*!
+         * \brief Get the bucket a value falls in.
+         * \param value Value to look up.
+         * \return Bucket index.
+         */
+        static constexpr std::size_t bucket_index(std::uint64_t value) noexcept {
+            if(value < (std::uint64_t(1) << sub_bucket_bits)) return static_cast<std::size_t>(value);
+            const std::size_t shift = msb(value) - sub_bucket_bits + 1;
+            return (shift << (sub_bucket_bits - 1)) + static_cast<std::size_t>(value >> shift);
+        };
+
+        /*!
+         * \brief Get the largest value that maps to a bucket.
+         * \param index Bucket index.
+         * \return Highest equivalent value.
+         */
+        static constexpr std::uint64_t bucket_upper(std::size_t index) noexcept {
+            if(index < (std::size_t(1) << sub_bucket_bits)) return index;
+            const std::size_t shift = (index >> (sub_bucket_bits - 1)) - 1;
+            const std::uint64_t mantissa = index - (shift << (sub_bucket_bits - 1));
+            return ((mantissa + 1) << shift) - 1;
+        };
+
+    private:
+        friend class latency_snapshot;
+
+        static constexpr std::size_t msb(std::uint64_t value) noexcept {
+            std::size_t pos = 0;
+            while(value >>= 1) pos++;
+            return pos;
+        };
+
+        //  Single writer, so a load and store is enough and avoids a locked add.
+        static inline void bump(std::atomic<std::uint64_t>& a, std::uint64_t v) noexcept {
+            a.store(a.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+        };
+
+        std::atomic<std::uint64_t> counts[bucket_count];
+        std::atomic<std::uint64_t> total {0};
+        std::atomic<std::uint64_t> sum {0};
+        std::atomic<std::uint64_t> min {std::numeric_limits<std::uint64_t>::max()};
+        std::atomic<std::uint64_t> max {0};
+};
+
+/*!
+ * \class latency_snapshot
+ * \brief Merged, point in time copy of one or more histograms.
+ */
+class latency_snapshot {
+    public:
+        latency_snapshot() : counts(latency_histogram::bucket_count, 0) {};
+        ~latency_snapshot() = default;  //!<  Default destructor.
+
+        /*!
+         * \brief Add the contents of a histogram to the snapshot.
+         * \param hist Histogram to merge.
+         */
+        void merge(const latency_histogram& hist) {
+            for(std::size_t i = 0; i < latency_histogram::bucket_count; i++)
+                counts[i] += hist.counts[i].load(std::memory_order_relaxed);
+            merge_totals(hist.total.load(std::memory_order_relaxed), hist.sum.load(std::memory_order_relaxed),
+                         hist.min.load(std::memory_order_relaxed), hist.max.load(std::memory_order_relaxed));
+        };
+
+        /*!
+         * \brief Add the contents of another snapshot.
+         * \param snap Snapshot to merge.
+         */
+        void merge(const latency_snapshot& snap) {
+            for(std::size_t i = 0; i < counts.size(); i++) counts[i] += snap.counts[i];
+            merge_totals(snap.total, snap.sum, snap.min, snap.max);
+        };
+
+        /*!
+         * \brief Add the totals of values whose bucket counts were added separately.
+         * \param count Number of values.
+         * \param value_sum Sum of the values.
+         * \param lo Smallest value.
+         * \param hi Largest value.
+         */
+        void merge_totals(const std::uint64_t& count, const std::uint64_t& value_sum,
+                          const std::uint64_t& lo, const std::uint64_t& hi) {
+            total += count;
+            sum += value_sum;
+            if(lo < min) min = lo;
+            if(hi > max) max = hi;
+        };
+
+        /*!
+         * \brief Get the value at a percentile.
+         * \param pct Percentile, 0 to 100.
+         * \return Highest equivalent value of the bucket containing the percentile.
+         */
+        std::uint64_t percentile(double pct) const {
+            if(total == 0) return 0;
+            if(pct <= 0.0) return min;
+            if(pct >= 100.0) return max;
+            std::uint64_t target = static_cast<std::uint64_t>((pct / 100.0) * total + 0.5);
+            if(target == 0) target = 1;
+            std::uint64_t seen = 0;
+            for(std::size_t i = 0; i < counts.size(); i++) {
+                seen += counts[i];
+                if(seen >= target) {
+                    const std::uint64_t upper = latency_histogram::bucket_upper(i);
+                    return upper > max ? max : upper;
+                }
+            }
+            return max;
+        };
+
+        /*!
+         * \brief Get the mean of all recorded values.
+         * \return Mean value.
+         */
+        double mean(void) const {
+            return total == 0 ? 0.0 : static_cast<double>(sum) / static_cast<double>(total);
+        };
+
+        /*!
+         * \brief Write the sample count, min, mean, max and main percentiles.
+         * \param out Stream to write to.
+         */
+        void write_summary(std::ostream& out) const {
+            out << "Samples:  " << total << std::endl;
+            out << "Min / mean / max:  " << min << " / " <<
+                static_cast<std::uint64_t>(mean()) << " / " << max << " ns" << std::endl;
+            out << "p50 / p90 / p99 / p99.9:  " << percentile(50.0) << " / " <<
+                percentile(90.0) << " / " << percentile(99.0) << " / " <<
+                percentile(99.9) << " ns" << std::endl;
+        };
+
+        std::vector<std::uint64_t> counts;  //!<  Per bucket counts.
+        std::uint64_t total = 0;            //!<  Number of values recorded.
+        std::uint64_t sum = 0;              //!<  Sum of values recorded.
+        std::uint64_t min = std::numeric_limits<std::uint64_t>::max();  //!<  Smallest value.
+        std::uint64_t max = 0;              //!<  Largest value.
+};
+
+/*!
+ * \class latency_recorder
+ * \brief Registry of per label histograms.
+ * Each thread gets its own histogram per label.  Lookups after the
+ * first record from a thread do not lock.
+ */
+class latency_recorder {
+    public:
+        /*!
+         * \class series
+         * \brief All histograms recorded under one label.
+         */
+        class series {
+            public:
+                series(const std::string& l, const std::size_t& i) : label(l), id(i) {};
+                ~series() = default;  //!<  Default destructor.
+
+                /*!
+                 * \brief Record a value into the calling thread's histogram.
+                 * Does nothing when instrumentation is off.
+                 * \param value Value to record.
+                 */
+                inline void record(const std::uint64_t& value) {
+                    if(benchmark_enabled()) local().record(value);
+                };
+
+                /*!
+                 * \brief Add a whole histogram into the calling thread's histogram.
+                 * Cheaper than recording each value again when a run kept its own.
+                 * Does nothing when instrumentation is off.
+                 * \param hist Histogram to add.
+                 */
+                void merge(const latency_histogram& hist) {
+                    if(benchmark_enabled()) local().add(hist);
+                };
+
+                /*!
+                 * \brief Merge all thread histograms for this label.
+                 * \return Merged snapshot.
+                 */
+                latency_snapshot snapshot(void) const {
+                    latency_snapshot snap;
+                    std::lock_guard<std::mutex> lock(series_mtx);
+                    for(auto& h : histograms) snap.merge(*h);
+                    return snap;
+                };
+
+                const std::string label;  //!<  Series label.
+                const std::size_t id;     //!<  Index used for the per thread lookup.
+
+            private:
+                //  Histograms used by one thread, returned to their series when it exits.
+                struct thread_cache {
+                    std::vector<std::pair<series*, latency_histogram*>> slots;  //  Indexed by series id
+                    ~thread_cache() {
+                        for(auto& s : slots) if(s.second != nullptr) s.first->release(s.second);
+                    };
+                };
+
+                latency_histogram& local(void) {
+                    thread_local thread_cache cache;
+                    if(id < cache.slots.size() && cache.slots[id].second != nullptr) return *cache.slots[id].second;
+                    if(id >= cache.slots.size()) cache.slots.resize(id + 1, { nullptr, nullptr });
+                    std::lock_guard<std::mutex> guard(series_mtx);
+                    //  Reuse a histogram from an exited thread.  Its counts are kept,
+                    //  this thread adds to them.  The lock orders the two writers.
+                    latency_histogram* hist = nullptr;
+                    if(!released.empty()) {
+                        hist = released.back();
+                        released.pop_back();
+                    } else {
+                        histograms.push_back(std::make_unique<latency_histogram>());
+                        hist = histograms.back().get();
+                    }
+                    cache.slots[id] = { this, hist };
+                    return *hist;
+                };
+
+                void release(latency_histogram* hist) {
+                    std::lock_guard<std::mutex> guard(series_mtx);
+                    released.push_back(hist);
+                };
+
+                mutable std::mutex series_mtx;  //  Guards the histogram lists
+                //  Histograms are owned here so they outlive the threads that wrote them.
+                std::vector<std::unique_ptr<latency_histogram>> histograms;
+                std::vector<latency_histogram*> released;  //  Histograms with no writing thread
+        };
+
+        /*!
+         * \brief Get the process wide recorder.
+         * Never destroyed so threads may record during shutdown.
+         */
+        static latency_recorder& instance(void) {
+            static latency_recorder* recorder = new latency_recorder();
+            return *recorder;
+        };
+
+        /*!
+         * \brief Get or create the series for a label.
+         * Keep the reference to avoid the lookup on the hot path.
+         * \param label Series label.
+         * \return Reference to the series.
+         */
+        series& get(const std::string& label) {
+            std::lock_guard<std::mutex> lock(recorder_mtx);
+            auto it = all_series.find(label);
+            if(it != all_series.end()) return *it->second;
+            auto res = all_series.emplace(label, std::make_unique<series>(label, all_series.size()));
+            return *res.first->second;
+        };
+
+        /*!
+         * \brief Record a value under a label.
+         * \param label Series label.
+         * \param value Value to record.
+         */
+        void record(const std::string& label, const std::uint64_t& value) { get(label).record(value); };
+
+        /*!
+         * \brief Get a merged snapshot for a label.
+         * \param label Series label.
+         * \return Merged snapshot, empty if the label was never recorded.
+         */
+        latency_snapshot snapshot(const std::string& label) {
+            std::lock_guard<std::mutex> lock(recorder_mtx);
+            auto it = all_series.find(label);
+            if(it == all_series.end()) return latency_snapshot();
+            return it->second->snapshot();
+        };
+
+        /*!
+         * \brief Get all recorded labels.
+         * \return Vector of labels.
+         */
+        std::vector<std::string> labels(void) const {
+            std::vector<std::string> res;
+            std::lock_guard<std::mutex> lock(recorder_mtx);
+            for(auto& s : all_series) res.push_back(s.first);
+            return res;
+        };
+
+        /*!
+         * \brief Write a percentile summary of every label.
+         * \param out Stream to write to.
+         */
+        void report(std::ostream& out) {
+            for(auto& label : labels()) {
+                const latency_snapshot snap = snapshot(label);
+                if(snap.total == 0) continue;
+                out << "Histogram:  " << label << std::endl;
+                snap.write_summary(out);
+                out << std::endl;
+            }
+        };
+
+    private:
+        latency_recorder() = default;
+        ~latency_recorder() = default;
+
+        mutable std::mutex recorder_mtx;  //  Guards the series map
+        std::map<std::string, std::unique_ptr<series>> all_series;
+};
+
+}  //  end namespace wtf
+
+#endif
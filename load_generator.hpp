@@ -0,0 +1,194 @@
+/*
+ * Load Generator
+ * By:  Matthew Evans
+ * File:  load_generator.hpp
+ * Version:  101826
+ *
+ * See LICENSE.md for copyright information.
+ *
+ * Load generation for measuring latency under a target rate.
+ * Each thread follows a fixed schedule of intended start times but runs one
+ * operation at a time, so concurrency is bounded by the thread count.  A
+ * slow operation makes the thread start the ones after it late, back to
+ * back, until it catches up with the schedule.
+ *
+ * Latency is measured from the time an operation was meant to start, so a
+ * stall counts against every operation scheduled behind it instead of being
+ * hidden.  This corrects the latency for coordinated omission, but the
+ * achieved rate still drops if operations run longer than the schedule
+ * allows.  Use enough threads to cover the concurrency the rate needs, and
+ * check late_ops and achieved_rate in the result.
+ *
+ * Latency from the intended start is recorded under the label and the time
+ * spent in the operation itself under "label/service", both in the
+ * latency_recorder once the run ends.  Workers record into their own
+ * histograms while running.  A summary is logged through benchmark_output.
+ *
+ * Nothing is run when instrumentation is off, see benchmark_control.hpp.
+ *
+ * Arrivals are evenly spaced by default.  Set poisson for exponential gaps,
+ * closer to independent clients.
+ *
+ * Example:
+ *
+ * wtf::load_options opts;
+ * opts.rate = 20000;                          //  Operations per second, all threads
+ * opts.duration = std::chrono::seconds(10);
+ * opts.threads = 4;
+ * wtf::load_result res = wtf::run_open_loop("md5 16 bytes", opts,
+ *     [&](std::size_t thread, std::uint64_t op) { hash(keys[op % keys.size()]); });
+ * std::cout << res.latency.percentile(99.9) << " ns p99.9";
+ *
+ */
+
+#ifndef WTF_LOAD_GENERATOR_HPP
+#define WTF_LOAD_GENERATOR_HPP
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <chrono>
+#include <random>
+#include <functional>
+#include <cstdint>
+
+#include "benchmark_control.hpp"
+#include "latency_histogram.hpp"
+#include "benchmark_output.hpp"
+#include "benchmark_scaling.hpp"
+
+namespace wtf {
+
+/*!
+ * \struct load_options
+ * \brief Settings for an open loop run.
+ */
+struct load_options {
+    double rate = 1000.0;                                    //!<  Target operations per second over all threads.
+    std::chrono::nanoseconds duration = std::chrono::seconds(5);  //!<  How long to issue operations.
+    std::size_t threads = 1;                                 //!<  Issuing threads.
+    bool poisson = false;                                    //!<  Exponential gaps instead of even spacing.
+    //!  Waits longer than this sleep, shorter ones spin.
+    std::chrono::nanoseconds spin_below = std::chrono::microseconds(50);
+};
+
+/*!
+ * \struct load_result
+ * \brief Results of an open loop run.
+ */
+struct load_result {
+    std::uint64_t completed = 0;    //!<  Operations completed.
+    std::uint64_t late = 0;         //!<  Operations that started after their intended time plus spin_below.
+    double target_rate = 0.0;       //!<  Requested operations per second.
+    double achieved_rate = 0.0;     //!<  Completed operations per second.
+    latency_snapshot latency;       //!<  Nanoseconds from intended start to completion.
+    latency_snapshot service;       //!<  Nanoseconds from actual start to completion.
+};
+
+/*!
+ * \brief Issue operations at a target rate and measure their latency.
+ * \param label Benchmark label.
+ * \param opts Rate, duration and threads.
+ * \param op Operation, called with the thread index and that thread's operation number.
+ * \return Latency and rate results, empty if instrumentation is off.
+ */
+inline load_result run_open_loop(
+    const std::string& label,
+    const load_options& opts,
+    const std::function<void(std::size_t, std::uint64_t)>& op
+) {
+    if(!benchmark_enabled()) return {};
+    using clock = std::chrono::steady_clock;
+    const std::size_t threads = opts.threads == 0 ? 1 : opts.threads;
+    const double thread_rate = (opts.rate > 0.0 ? opts.rate : 1.0) / static_cast<double>(threads);
+    const double gap_ns = 1e9 / thread_rate;
+
+    //  Each worker records into its own histograms, added to the recorder after the run.
+    std::vector<std::unique_ptr<latency_histogram>> latency(threads), service(threads);
+    for(std::size_t t = 0; t < threads; t++) {
+        latency[t] = std::make_unique<latency_histogram>();
+        service[t] = std::make_unique<latency_histogram>();
+    }
+    std::vector<std::uint64_t> late(threads, 0);
+    start_barrier barrier(threads + 1);
+
+    auto worker = [&](const std::size_t t) {
+        std::mt19937_64 rng(0x5EED + t);
+        std::exponential_distribution<double> poisson_gap(1.0 / gap_ns);
+        std::uint64_t late_ops = 0;  //  Local so workers do not share a cache line
+        latency_histogram& thread_latency = *latency[t];
+        latency_histogram& thread_service = *service[t];
+        const clock::time_point start = barrier.arrive_and_wait();
+        const clock::time_point end = start + opts.duration;
+        //  Threads start offset from each other so even arrivals do not line up.
+        double offset_ns = gap_ns * static_cast<double>(t) / static_cast<double>(threads);
+        for(std::uint64_t n = 0; ; n++) {
+            const clock::time_point intended = start + std::chrono::nanoseconds(static_cast<std::int64_t>(offset_ns));
+            if(intended >= end) break;
+            offset_ns += opts.poisson ? poisson_gap(rng) : gap_ns;
+            clock::time_point now = clock::now();
+            if(intended - now > opts.spin_below) std::this_thread::sleep_until(intended - opts.spin_below);
+            while((now = clock::now()) < intended) {}
+            if(now - intended > opts.spin_below) late_ops++;
+            op(t, n);
+            const clock::time_point done = clock::now();
+            const auto from_intended = std::chrono::duration_cast<std::chrono::nanoseconds>(done - intended).count();
+            const auto from_start = std::chrono::duration_cast<std::chrono::nanoseconds>(done - now).count();
+            thread_latency.record(static_cast<std::uint64_t>(from_intended));
+            thread_service.record(static_cast<std::uint64_t>(from_start));
+        }
+        late[t] = late_ops;
+    };
+
+    std::vector<std::thread> pool;
+    for(std::size_t t = 0; t < threads; t++) pool.emplace_back(worker, t);
+    const clock::time_point start = barrier.arrive_and_wait();
+    const auto wall_start = std::chrono::system_clock::now() - (clock::now() - start);
+    for(auto& p : pool) p.join();
+    const auto elapsed_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count();
+
+    load_result res;
+    res.target_rate = opts.rate;
+    latency_recorder::series& latency_series = latency_recorder::instance().get(label);
+    latency_recorder::series& service_series = latency_recorder::instance().get(label + "/service");
+    for(std::size_t t = 0; t < threads; t++) {
+        res.latency.merge(*latency[t]);
+        res.service.merge(*service[t]);
+        latency_series.merge(*latency[t]);
+        service_series.merge(*service[t]);
+        res.late += late[t];
+    }
+    res.completed = res.latency.total;
+    res.achieved_rate = benchmark_output::per_second(res.completed, elapsed_ns);
+
+    benchmark_record rec;
+    rec.label = label;
+    rec.name = label;
+    rec.start = wall_start;
+    rec.end = wall_start + std::chrono::nanoseconds(elapsed_ns);
+    rec.elapsed_ns = elapsed_ns;
+    rec.elapsed = elapsed_ns;
+    rec.self_ns = elapsed_ns;
+    rec.self = elapsed_ns;
+    rec.unit = "nanoseconds";
+    rec.thread_id = benchmark_output::thread_id();
+    rec.items = res.completed;
+    rec.metrics = {
+        { "target_rate", res.target_rate },
+        { "threads", static_cast<double>(threads) },
+        { "late_ops", static_cast<double>(res.late) },
+        { "latency_p50_ns", static_cast<double>(res.latency.percentile(50.0)) },
+        { "latency_p99_ns", static_cast<double>(res.latency.percentile(99.0)) },
+        { "latency_p99_9_ns", static_cast<double>(res.latency.percentile(99.9)) },
+        { "latency_max_ns", static_cast<double>(res.latency.max) },
+        { "service_p50_ns", static_cast<double>(res.service.percentile(50.0)) },
+        { "service_p99_ns", static_cast<double>(res.service.percentile(99.0)) }
+    };
+    benchmark_output::instance().write(rec);
+    return res;
+};
+
+}  //  end namespace wtf
+
+#endif
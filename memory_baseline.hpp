@@ -0,0 +1,338 @@
+/*
+ * Memory Baseline
+ * By:  Matthew Evans
+ * File:  memory_baseline.hpp
+ * Version:  101826
+ *
+ * See LICENSE.md for copyright information.
+ *
+ * Measure the machine's cache and memory limits so workload results can be
+ * read as a percentage of what the hardware can do.
+ *
+ * For L1, L2, L3 and DRAM a working set is sized to fit that level (half
+ * its size, or four times L3 for DRAM) and measured for:
+ *
+ *   latency     Pointer chasing through a random cycle of cache lines.
+ *   read        Streaming sum of 64 bit words.
+ *   write       Streaming fill.
+ *   copy        memcpy from one half of the working set to the other.
+ *
+ * Bandwidth is measured on one thread and on every hardware thread, each
+ * thread using its own buffer.  L1 and L2 are per core, so each thread gets
+ * a full working set.  L3 and DRAM are shared, so the working set is split.
+ *
+ * Each result is logged as a benchmark record with the per thread working
+ * set, eg "baseline/read/L2/threads:1", so it appears beside workload
+ * results.  Cache sizes come from /sys on Linux, otherwise defaults are used.
+ *
+ * Example:
+ *
+ * wtf::memory_baseline base = wtf::run_memory_baseline();
+ *   ~~~ run md5 over a 16 MiB buffer ~~~
+ * double pct = base.percent_of_read(md5_bytes_per_second, "L3");
+ *
+ */
+
+#ifndef WTF_MEMORY_BASELINE_HPP
+#define WTF_MEMORY_BASELINE_HPP
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <random>
+#include <numeric>
+#include <algorithm>
+#include <fstream>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+
+#include "benchmark_output.hpp"
+#include "benchmark_scaling.hpp"
+
+namespace wtf {
+
+/*!
+ * \struct memory_level
+ * \brief Measured limits of one level of the memory hierarchy.
+ */
+struct memory_level {
+    std::string name;                   //!<  L1, L2, L3 or DRAM.
+    std::size_t size = 0;               //!<  Cache size in bytes, zero for DRAM.
+    std::size_t working_set = 0;        //!<  Bytes used to measure it on one thread.
+    std::size_t working_set_multi = 0;  //!<  Bytes used by each thread for the multi-threaded results.
+    double latency_ns = 0.0;            //!<  Nanoseconds per dependent load.
+    double read_single = 0.0;           //!<  Bytes per second read by one thread.
+    double write_single = 0.0;          //!<  Bytes per second written by one thread.
+    double copy_single = 0.0;           //!<  Bytes per second copied by one thread.
+    double read_multi = 0.0;            //!<  Bytes per second read by all threads.
+    double write_multi = 0.0;           //!<  Bytes per second written by all threads.
+    double copy_multi = 0.0;            //!<  Bytes per second copied by all threads.
+};
+
+/*!
+ * \struct memory_baseline
+ * \brief Measured limits of the whole memory hierarchy.
+ */
+struct memory_baseline {
+    std::size_t threads = 1;             //!<  Threads used for the multi-threaded results.
+    std::vector<memory_level> levels;    //!<  Results from L1 to DRAM.
+
+    /*!
+     * \brief Find a level by name.
+     * \param name L1, L2, L3 or DRAM.
+     * \return Pointer to the level, nullptr if not measured.
+     */
+    const memory_level* level(const std::string& name) const {
+        for(auto& l : levels) if(l.name == name) return &l;
+        return nullptr;
+    };
+
+    /*!
+     * \brief Compare a workload's rate to the single thread read bandwidth of a level.
+     * \param bytes_per_second Workload throughput.
+     * \param name Level the workload's data lives in.
+     * \param multi True to compare against the all thread bandwidth.
+     * \return Percentage of the level's bandwidth, zero if the level was not measured.
+     */
+    double percent_of_read(const double& bytes_per_second, const std::string& name, const bool& multi = false) const {
+        const memory_level* l = level(name);
+        if(l == nullptr) return 0.0;
+        const double peak = multi ? l->read_multi : l->read_single;
+        return peak > 0.0 ? 100.0 * bytes_per_second / peak : 0.0;
+    };
+};
+
+namespace detail {
+
+//  Stop the compiler from removing work whose result is never used.
+inline void escape(void* ptr) {
+#if defined(__GNUC__)
+    asm volatile("" : : "g"(ptr) : "memory");
+#else
+    static void* volatile sink;
+    sink = ptr;
+#endif
+};
+
+//  Parse sizes like "32K" or "8M" from /sys.
+inline std::size_t parse_cache_size(const std::string& str) {
+    if(str.empty()) return 0;
+    std::size_t size = std::strtoull(str.c_str(), nullptr, 10);
+    const char suffix = str.back();
+    if(suffix == 'K') size *= 1024;
+    else if(suffix == 'M') size *= 1024 * 1024;
+    else if(suffix == 'G') size *= 1024 * 1024 * 1024;
+    return size;
+};
+
+//  One cache line holding the index of the next line to visit.
+struct alignas(64) chase_line {
+    std::size_t next;
+};
+
+}  //  end namespace detail
+
+/*!
+ * \brief Get the data cache sizes of CPU 0.
+ * \return L1, L2 and L3 sizes in bytes.  Defaults of 32 KiB, 1 MiB and 32 MiB if unknown.
+ */
+inline std::vector<std::size_t> cache_sizes(void) {
+    std::vector<std::size_t> res = { 32 * 1024, 1024 * 1024, 32 * 1024 * 1024 };
+#if defined(__linux__)
+    const std::string dir = "/sys/devices/system/cpu/cpu0/cache/index";
+    for(int i = 0; i < 8; i++) {
+        std::ifstream level_file(dir + std::to_string(i) + "/level");
+        std::ifstream type_file(dir + std::to_string(i) + "/type");
+        std::ifstream size_file(dir + std::to_string(i) + "/size");
+        if(!level_file.is_open() || !type_file.is_open() || !size_file.is_open()) break;
+        int level = 0;
+        std::string type, size;
+        level_file >> level;
+        type_file >> type;
+        size_file >> size;
+        if(type == "Instruction" || level < 1 || level > 3) continue;
+        const std::size_t bytes = detail::parse_cache_size(size);
+        if(bytes > 0) res[level - 1] = bytes;
+    }
+#endif
+    return res;
+};
+
+/*!
+ * \brief Measure the latency of dependent loads over a working set.
+ * \param bytes Working set size.
+ * \param min_time Shortest time to measure for.
+ * \return Nanoseconds per load.
+ */
+inline double measure_latency(const std::size_t& bytes, const std::chrono::nanoseconds& min_time) {
+    const std::size_t lines = std::max<std::size_t>(bytes / sizeof(detail::chase_line), 2);
+    std::vector<detail::chase_line> chain(lines);
+    //  Visit lines in a random order so the prefetcher can not predict the next load.
+    std::vector<std::size_t> order(lines);
+    std::iota(order.begin(), order.end(), 0);
+    std::shuffle(order.begin() + 1, order.end(), std::mt19937_64(lines));
+    for(std::size_t i = 0; i < lines; i++) chain[order[i]].next = order[(i + 1) % lines];
+
+    std::size_t pos = 0;
+    for(std::size_t i = 0; i < lines; i++) pos = chain[pos].next;  //  Warm up
+    std::uint64_t loads = 0;
+    //  Enough loads between clock reads that reading the clock does not count.
+    const std::size_t step = std::max<std::size_t>(lines, 1 << 16);
+    const auto start = std::chrono::steady_clock::now();
+    auto elapsed = std::chrono::steady_clock::duration::zero();
+    do {
+        for(std::size_t i = 0; i < step; i++) pos = chain[pos].next;
+        loads += step;
+        elapsed = std::chrono::steady_clock::now() - start;
+    } while(elapsed < min_time);
+    detail::escape(&pos);
+    return static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()) /
+           static_cast<double>(loads);
+};
+
+//!  Memory access pattern for bandwidth tests.
+enum class bandwidth_kind { read, write, copy };
+
+/*!
+ * \brief Measure streaming bandwidth over a working set.
+ * \param bytes Working set size per thread.
+ * \param kind Read, write or copy.
+ * \param threads Number of threads, each with its own buffer.
+ * \param min_time Shortest time to measure for.
+ * \return Total bytes per second over all threads.  Copy counts bytes copied.
+ */
+inline double measure_bandwidth(
+    const std::size_t& bytes,
+    const bandwidth_kind& kind,
+    const std::size_t& threads,
+    const std::chrono::nanoseconds& min_time
+) {
+    const std::size_t words = std::max<std::size_t>(bytes / sizeof(std::uint64_t), 16) & ~std::size_t(7);
+    std::vector<std::vector<std::uint64_t>> buffers(threads, std::vector<std::uint64_t>(words, 1));
+    std::vector<std::uint64_t> moved(threads, 0);
+    std::vector<std::chrono::steady_clock::duration> times(threads);
+    start_barrier barrier(threads);
+
+    auto worker = [&](const std::size_t& t) {
+        std::uint64_t* data = buffers[t].data();
+        std::uint64_t total = 0;
+        std::uint64_t sum[4] = { 0, 0, 0, 0 };
+        barrier.arrive_and_wait();
+        const auto start = std::chrono::steady_clock::now();
+        auto elapsed = std::chrono::steady_clock::duration::zero();
+        do {
+            switch(kind) {
+                case bandwidth_kind::read:
+                    //  Independent sums so the loop is not limited by add latency.
+                    for(std::size_t i = 0; i < words; i += 4) {
+                        sum[0] += data[i];
+                        sum[1] += data[i + 1];
+                        sum[2] += data[i + 2];
+                        sum[3] += data[i + 3];
+                    }
+                    total += words * sizeof(std::uint64_t);
+                    break;
+                case bandwidth_kind::write:
+                    std::fill(data, data + words, total);
+                    total += words * sizeof(std::uint64_t);
+                    break;
+                case bandwidth_kind::copy:
+                    std::memcpy(data + words / 2, data, words / 2 * sizeof(std::uint64_t));
+                    total += words / 2 * sizeof(std::uint64_t);
+                    break;
+            }
+            detail::escape(data);
+            elapsed = std::chrono::steady_clock::now() - start;
+        } while(elapsed < min_time);
+        detail::escape(sum);
+        moved[t] = total;
+        times[t] = elapsed;
+    };
+
+    std::vector<std::thread> pool;
+    for(std::size_t t = 1; t < threads; t++) pool.emplace_back(worker, t);
+    worker(0);
+    for(auto& p : pool) p.join();
+
+    double rate = 0.0;
+    for(std::size_t t = 0; t < threads; t++) {
+        const double sec = std::chrono::duration<double>(times[t]).count();
+        if(sec > 0.0) rate += static_cast<double>(moved[t]) / sec;
+    }
+    return rate;
+};
+
+/*!
+ * \brief Measure every level of the memory hierarchy and log the results.
+ * \param threads Threads for the multi-threaded results, zero for the hardware thread count.
+ * \param min_time Shortest time for each measurement.
+ * \return Measured limits.
+ */
+inline memory_baseline run_memory_baseline(
+    std::size_t threads = 0,
+    const std::chrono::nanoseconds& min_time = std::chrono::milliseconds(100)
+) {
+    if(threads == 0) threads = std::thread::hardware_concurrency();
+    if(threads == 0) threads = 1;
+    const std::vector<std::size_t> sizes = cache_sizes();
+    memory_baseline res;
+    res.threads = threads;
+    const char* names[] = { "L1", "L2", "L3", "DRAM" };
+    for(std::size_t i = 0; i < 4; i++) {
+        memory_level level;
+        level.name = names[i];
+        level.size = i < 3 ? sizes[i] : 0;
+        level.working_set = i < 3 ? sizes[i] / 2 : std::max<std::size_t>(sizes[2] * 4, 256 * 1024 * 1024);
+        level.latency_ns = measure_latency(level.working_set, min_time);
+        level.read_single = measure_bandwidth(level.working_set, bandwidth_kind::read, 1, min_time);
+        level.write_single = measure_bandwidth(level.working_set, bandwidth_kind::write, 1, min_time);
+        level.copy_single = measure_bandwidth(level.working_set, bandwidth_kind::copy, 1, min_time);
+        if(threads > 1) {
+            level.working_set_multi = (i < 2) ? level.working_set : level.working_set / threads;
+            const std::size_t ws = level.working_set_multi;
+            level.read_multi = measure_bandwidth(ws, bandwidth_kind::read, threads, min_time);
+            level.write_multi = measure_bandwidth(ws, bandwidth_kind::write, threads, min_time);
+            level.copy_multi = measure_bandwidth(ws, bandwidth_kind::copy, threads, min_time);
+        } else {
+            level.working_set_multi = level.working_set;
+            level.read_multi = level.read_single;
+            level.write_multi = level.write_single;
+            level.copy_multi = level.copy_single;
+        }
+        res.levels.push_back(level);
+    }
+
+    //  Log each result as a metric on an empty record.
+    auto log = [](const std::string& label, const std::string& metric, const double& value, const std::size_t& ws) {
+        benchmark_record rec;
+        rec.label = label;
+        rec.name = label;
+        rec.start = rec.end = std::chrono::system_clock::now();
+        rec.unit = "nanoseconds";
+        rec.type = "baseline";
+        rec.thread_id = benchmark_output::thread_id();
+        rec.metrics = { { metric, value }, { "working_set_bytes", static_cast<double>(ws) } };
+        benchmark_output::instance().write(rec);
+    };
+    const std::string multi = "/threads:" + std::to_string(threads);
+    for(auto& l : res.levels) {
+        const std::string base = "baseline/";
+        log(base + "latency/" + l.name, "ns_per_load", l.latency_ns, l.working_set);
+        log(base + "read/" + l.name + "/threads:1", "bandwidth_bytes_per_second", l.read_single, l.working_set);
+        log(base + "write/" + l.name + "/threads:1", "bandwidth_bytes_per_second", l.write_single, l.working_set);
+        log(base + "copy/" + l.name + "/threads:1", "bandwidth_bytes_per_second", l.copy_single, l.working_set);
+        if(threads > 1) {
+            log(base + "read/" + l.name + multi, "bandwidth_bytes_per_second", l.read_multi, l.working_set_multi);
+            log(base + "write/" + l.name + multi, "bandwidth_bytes_per_second", l.write_multi, l.working_set_multi);
+            log(base + "copy/" + l.name + multi, "bandwidth_bytes_per_second", l.copy_multi, l.working_set_multi);
+        }
+    }
+    benchmark_output::instance().flush();
+    return res;
+};
+
+}  //  end namespace wtf
+
+#endif
@@ -0,0 +1,226 @@
+/*
+ * Hardware Performance Counters
+ * By:  Matthew Evans
+ * File:  perf_counters.hpp
+ * Version:  101826
+ *
+ * See LICENSE.md for copyright information.
+ *
+ * Read CPU cycles, instructions, cache misses, branch misses and TLB misses
+ * for the calling thread using Linux perf_event_open.
+ * The counters are opened as one group led by the first event available,
+ * normally cycles, so they are scheduled on the PMU together and ratios
+ * such as IPC compare counts over the same time.  An event that can not
+ * join the group is opened on its own, and an unsupported event is skipped
+ * without disabling the rest.  On other platforms, or when perf is not
+ * permitted, all counters report as unavailable.
+ *
+ * Example:
+ *
+ * wtf::perf_counters counters;
+ * counters.start();
+ *   ~~~ do something ~~~
+ * wtf::perf_sample sample = counters.stop();
+ * if(sample.valid[wtf::perf_sample::cycles]) std::cout << sample.ipc();
+ *
+ */
+
+#ifndef WTF_PERF_COUNTERS_HPP
+#define WTF_PERF_COUNTERS_HPP
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__linux__)
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+namespace wtf {
+
+/*!
+ * \struct perf_sample
+ * \brief Counter values read from a measured region.
+ */
+struct perf_sample {
+    //!  Counters captured.
+    enum event { cycles, instructions, cache_misses, branch_misses, tlb_misses, event_count };
+
+    std::uint64_t values[event_count] = {};  //!<  Counter values, scaled if multiplexed.
+    bool valid[event_count] = {};            //!<  True if the counter was read.
+
+    /*!
+     * \brief Check if any counter was read.
+     * \return True if at least one counter is valid.
+     */
+    bool available(void) const {
+        for(std::size_t i = 0; i < event_count; i++) if(valid[i]) return true;
+        return false;
+    };
+
+    /*!
+     * \brief Instructions per cycle.
+     * \return IPC, or zero if cycles or instructions were not read.
+     */
+    double ipc(void) const {
+        if(!valid[cycles] || !valid[instructions] || values[cycles] == 0) return 0.0;
+        return static_cast<double>(values[instructions]) / static_cast<double>(values[cycles]);
+    };
+
+    /*!
+     * \brief Get a counter divided by an iteration count.
+     * \param ev Counter to read.
+     * \param iterations Number of iterations in the region.
+     * \return Counter value per iteration.
+     */
+    double per_iteration(const event& ev, const std::uint64_t& iterations) const {
+        if(!valid[ev] || iterations == 0) return 0.0;
+        return static_cast<double>(values[ev]) / static_cast<double>(iterations);
+    };
+
+    /*!
+     * \brief Get a display name for a counter.
+     * \param ev Counter to name.
+     * \return Counter name.
+     */
+    static const char* name(const event& ev) {
+        switch(ev) {
+            case cycles:        return "cycles";
+            case instructions:  return "instructions";
+            case cache_misses:  return "cache_misses";
+            case branch_misses: return "branch_misses";
+            case tlb_misses:    return "tlb_misses";
+            default:            return "unknown";
+        }
+    };
+};
+
+/*!
+ * \class perf_counters
+ * \brief Open hardware counters for the calling thread.
+ * Counters only measure the thread that created the object.
+ */
+class perf_counters {
+    public:
+        /*!
+         * \brief Open all counters.  Unsupported counters are skipped.
+         */
+        perf_counters() {
+            for(std::size_t i = 0; i < perf_sample::event_count; i++) {
+                fds[i] = -1;
+                leader_of[i] = i;
+            }
+#if defined(__linux__)
+            const std::uint64_t tlb_config = PERF_COUNT_HW_CACHE_DTLB |
+                (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+            open_member(perf_sample::cycles, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+            open_member(perf_sample::instructions, PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+            open_member(perf_sample::cache_misses, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+            open_member(perf_sample::branch_misses, PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+            open_member(perf_sample::tlb_misses, PERF_TYPE_HW_CACHE, tlb_config);
+#endif
+        };
+
+        ~perf_counters() {
+#if defined(__linux__)
+            for(std::size_t i = 0; i < perf_sample::event_count; i++) if(fds[i] != -1) close(fds[i]);
+#endif
+        };
+
+        perf_counters(const perf_counters&) = delete;
+        perf_counters& operator=(const perf_counters&) = delete;
+
+        /*!
+         * \brief Check if any counter could be opened.
+         * \return True if at least one counter is open.
+         */
+        bool available(void) const {
+            for(std::size_t i = 0; i < perf_sample::event_count; i++) if(fds[i] != -1) return true;
+            return false;
+        };
+
+        /*!
+         * \brief Reset and start all counters.
+         */
+        void start(void) {
+#if defined(__linux__)
+            for(std::size_t i = 0; i < perf_sample::event_count; i++) {
+                if(fds[i] == -1 || leader_of[i] != i) continue;
+                ioctl(fds[i], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+                ioctl(fds[i], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+            }
+#endif
+        };
+
+        /*!
+         * \brief Stop all counters and read them.
+         * \return Counter values.  Counters that could not be read are not valid.
+         */
+        perf_sample stop(void) {
+            perf_sample sample;
+#if defined(__linux__)
+            for(std::size_t i = 0; i < perf_sample::event_count; i++)
+                if(fds[i] != -1 && leader_of[i] == i) ioctl(fds[i], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+            for(std::size_t i = 0; i < perf_sample::event_count; i++) {
+                if(fds[i] == -1 || leader_of[i] != i) continue;
+                //  Member count, time enabled, time running, then each member's value in open order
+                std::uint64_t data[3 + perf_sample::event_count];
+                const ssize_t got = read(fds[i], data, sizeof(data));
+                if(got < static_cast<ssize_t>(3 * sizeof(std::uint64_t))) continue;
+                if(data[2] == 0) continue;  //  Never scheduled on the PMU
+                std::size_t member = 0;
+                for(std::size_t j = i; j < perf_sample::event_count && member < data[0]; j++) {
+                    if(fds[j] == -1 || leader_of[j] != i) continue;
+                    const std::uint64_t value = data[3 + member++];
+                    //  Scale up if the group was multiplexed with other events.
+                    sample.values[j] = (data[2] < data[1]) ?
+                        static_cast<std::uint64_t>(static_cast<double>(value) * data[1] / data[2]) : value;
+                    sample.valid[j] = true;
+                }
+            }
+#endif
+            return sample;
+        };
+
+    private:
+#if defined(__linux__)
+        //  Open an event in the group, or on its own if it can not join.
+        void open_member(const std::size_t& ev, const std::uint32_t& type, const std::uint64_t& config) {
+            if(group != -1) {
+                fds[ev] = open_event(type, config, fds[group]);
+                if(fds[ev] != -1) {
+                    leader_of[ev] = static_cast<std::size_t>(group);
+                    return;
+                }
+            }
+            fds[ev] = open_event(type, config, -1);
+            if(fds[ev] != -1 && group == -1) group = static_cast<int>(ev);
+        };
+
+        //  Members follow their leader, so only a leader starts disabled.
+        static int open_event(const std::uint32_t& type, const std::uint64_t& config, const int& group_fd) {
+            perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = type;
+            attr.config = config;
+            attr.disabled = group_fd == -1 ? 1 : 0;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            const long fd = syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0);
+            return fd < 0 ? -1 : static_cast<int>(fd);
+        };
+
+        int group = -1;                                   //  Event leading the group, -1 if none open
+#endif
+
+        int fds[perf_sample::event_count];                //  Counter file descriptors, -1 if unavailable
+        std::size_t leader_of[perf_sample::event_count];  //  Event whose group each counter is read with
+};
+
+}  //  end namespace wtf
+
+#endif
@@ -0,0 +1,364 @@
+/*
+ * Prometheus Exporter
+ * By:  Matthew Evans
+ * File:  prometheus_exporter.hpp
+ * Version:  101826
+ *
+ * See LICENSE.md for copyright information.
+ *
+ * Export benchmark timings in the Prometheus text exposition format.
+ * Every label in the latency_recorder is rendered as a histogram named
+ * <prefix>_duration_seconds with a "label" label.  Counters and gauges
+ * read from user functions may be added alongside.
+ *
+ * Aggregation happens when the metrics are rendered, on the exporter's own
+ * thread.  Code calling benchmark::record() is not slowed down.
+ *
+ * Metrics can be served over HTTP for scraping, or written to a file on an
+ * interval for the node_exporter textfile collector.  The file is replaced
+ * atomically.  HTTP needs POSIX sockets, elsewhere start_http() returns false.
+ *
+ * Example:
+ *
+ * wtf::prometheus_exporter exporter;
+ * exporter.add_counter("requests_total", "Requests served.", [&] { return requests.load(); });
+ * exporter.start_http(9464);    //  http://127.0.0.1:9464/metrics
+ *   ~~~ or ~~~
+ * exporter.start_file("/var/lib/node_exporter/app.prom", std::chrono::seconds(15));
+ *
+ */
+
+#ifndef WTF_PROMETHEUS_EXPORTER_HPP
+#define WTF_PROMETHEUS_EXPORTER_HPP
+
+#include <string>
+#include <vector>
+#include <sstream>
+#include <fstream>
+#include <filesystem>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define WTF_PROMETHEUS_HTTP_SUPPORTED 1
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif
+
+#include "latency_histogram.hpp"
+
+namespace wtf {
+
+/*!
+ * \class prometheus_exporter
+ * \brief Render and publish metrics in the Prometheus text format.
+ */
+class prometheus_exporter {
+    public:
+        /*!
+         * \brief Create the exporter.
+         * \param prefix Prefix for metric names.
+         * \param recorder Latency recorder to export.
+         */
+        prometheus_exporter(
+            const std::string& prefix = "wtf_benchmark",
+            latency_recorder& recorder = latency_recorder::instance()
+        ) : metric_prefix(metric_name(prefix)), source(recorder),
+        bounds({ 0.000001, 0.000005, 0.00001, 0.00005, 0.0001, 0.0005, 0.001,
+                 0.005, 0.01, 0.05, 0.1, 0.5, 1.0, 5.0, 10.0 }) {};
+
+        ~prometheus_exporter() { stop(); };  //!<  Stops the exporter thread.
+
+        prometheus_exporter(const prometheus_exporter&) = delete;
+        prometheus_exporter& operator=(const prometheus_exporter&) = delete;
+
+        /*!
+         * \brief Set the histogram bucket bounds.
+         * \param seconds Upper bounds in seconds, in increasing order.
+         */
+        void set_buckets(const std::vector<double>& seconds) {
+            std::lock_guard<std::mutex> lock(exporter_mtx);
+            bounds = seconds;
+        };
+
+        /*!
+         * \brief Add a counter read when metrics are rendered.
+         * \param name Metric name, the prefix is added.
+         * \param help Help text.
+         * \param read Function returning the current value.
+         */
+        void add_counter(const std::string& name, const std::string& help, std::function<double(void)> read) {
+            std::lock_guard<std::mutex> lock(exporter_mtx);
+            values.push_back({ metric_prefix + "_" + metric_name(name), help, "counter", std::move(read) });
+        };
+
+        /*!
+         * \brief Add a gauge read when metrics are rendered.
+         * \param name Metric name, the prefix is added.
+         * \param help Help text.
+         * \param read Function returning the current value.
+         */
+        void add_gauge(const std::string& name, const std::string& help, std::function<double(void)> read) {
+            std::lock_guard<std::mutex> lock(exporter_mtx);
+            values.push_back({ metric_prefix + "_" + metric_name(name), help, "gauge", std::move(read) });
+        };
+
+        /*!
+         * \brief Render all metrics.
+         * \return Metrics in the Prometheus text exposition format.
+         */
+        std::string render(void) {
+            std::lock_guard<std::mutex> lock(exporter_mtx);
+            std::ostringstream out;
+            out.precision(9);
+
+            const std::string hist = metric_prefix + "_duration_seconds";
+            out << "# HELP " << hist << " Benchmark durations recorded by label.\n";
+            out << "# TYPE " << hist << " histogram\n";
+            for(auto& label : source.labels()) {
+                const latency_snapshot snap = source.snapshot(label);
+                const std::string lbl = "label=\"" + escape_label(label) + "\"";
+                //  Bucket bounds are inclusive, so a bucket counts towards a bound
+                //  only if every value it holds is at or below the bound.
+                std::size_t idx = 0;
+                std::uint64_t cumulative = 0;
+                for(auto& b : bounds) {
+                    const double ns = b * 1e9;
+                    while(idx < snap.counts.size() &&
+                          static_cast<double>(latency_histogram::bucket_upper(idx)) <= ns)
+                        cumulative += snap.counts[idx++];
+                    out << hist << "_bucket{" << lbl << ",le=\"" << b << "\"} " << cumulative << "\n";
+                }
+                out << hist << "_bucket{" << lbl << ",le=\"+Inf\"} " << snap.total << "\n";
+                out << hist << "_sum{" << lbl << "} " << static_cast<double>(snap.sum) / 1e9 << "\n";
+                out << hist << "_count{" << lbl << "} " << snap.total << "\n";
+            }
+
+            for(auto& v : values) {
+                out << "# HELP " << v.name << " " << escape_help(v.help) << "\n";
+                out << "# TYPE " << v.name << " " << v.type << "\n";
+                out << v.name << " " << v.read() << "\n";
+            }
+            return out.str();
+        };
+
+        /*!
+         * \brief Write all metrics to a file.
+         * Written to a temporary file then renamed so readers never see a partial file.
+         * \param path File to write.
+         * \throws std::runtime_error if the file can not be written.
+         */
+        void write_file(const std::string& path) {
+            const std::string data = render();
+            const std::filesystem::path parent = std::filesystem::path(path).parent_path();
+            std::error_code ec;
+            if(!parent.empty()) std::filesystem::create_directories(parent, ec);
+            const std::string tmp = path + ".tmp";
+            {
+                std::ofstream file(tmp, std::ios::trunc | std::ios::binary);
+                if(!file.is_open()) throw std::runtime_error("Unable to open metrics file:  " + tmp);
+                file.write(data.data(), data.size());
+                if(!file) throw std::runtime_error("Unable to write metrics file:  " + tmp);
+            }
+            std::filesystem::rename(tmp, path, ec);
+            if(ec) throw std::runtime_error("Unable to replace metrics file:  " + path);
+        };
+
+        /*!
+         * \brief Start a thread writing the metrics file on an interval.
+         * Write errors are ignored so a full disk does not stop the exporter.
+         * \param path File to write.
+         * \param interval Time between writes.
+         * \return False if the exporter is already running.
+         */
+        bool start_file(const std::string& path, const std::chrono::milliseconds& interval) {
+            if(running.exchange(true)) return false;
+            worker = std::thread([this, path, interval] {
+                std::unique_lock<std::mutex> lock(stop_mtx);
+                do {
+                    lock.unlock();
+                    try { write_file(path); } catch(const std::exception&) {}
+                    lock.lock();
+                } while(!stop_cv.wait_for(lock, interval, [this] { return !running.load(); }));
+                lock.unlock();
+                try { write_file(path); } catch(const std::exception&) {}
+            });
+            return true;
+        };
+
+        /*!
+         * \brief Start a thread serving the metrics over HTTP.
+         * Any GET request is answered with the metrics, one connection at a time.
+         * A client gets one second to send its request and read the reply.
+         * \param port TCP port, zero to pick a free port.  See port().
+         * \param address IPv4 address to bind to.
+         * \return False if HTTP is not supported or the exporter is already running.
+         * \throws std::runtime_error if the socket can not be bound.
+         */
+        bool start_http(const std::uint16_t& port, const std::string& address = "127.0.0.1") {
+#if defined(WTF_PROMETHEUS_HTTP_SUPPORTED)
+            if(running.load()) return false;
+            const int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+            if(fd < 0) throw std::runtime_error("Unable to create metrics socket.");
+            const int on = 1;
+            ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+            sockaddr_in addr;
+            std::memset(&addr, 0, sizeof(addr));
+            addr.sin_family = AF_INET;
+            addr.sin_port = htons(port);
+            if(::inet_pton(AF_INET, address.c_str(), &addr.sin_addr) != 1 ||
+               ::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+               ::listen(fd, 16) != 0) {
+                ::close(fd);
+                throw std::runtime_error("Unable to bind metrics socket:  " + address + ":" + std::to_string(port));
+            }
+            socklen_t len = sizeof(addr);
+            ::getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &len);
+            bound_port = ntohs(addr.sin_port);
+            running = true;
+            worker = std::thread([this, fd] { serve(fd); });
+            return true;
+#else
+            (void)port;
+            (void)address;
+            return false;
+#endif
+        };
+
+        /*!
+         * \brief Stop the exporter thread.  A file exporter writes once more before exiting.
+         */
+        void stop(void) {
+            {
+                std::lock_guard<std::mutex> lock(stop_mtx);
+                running = false;
+            }
+            stop_cv.notify_all();
+            if(worker.joinable()) worker.join();
+        };
+
+        /*!
+         * \brief Get the port the HTTP server is listening on.
+         * \return Port number, zero if not serving.
+         */
+        std::uint16_t port(void) const { return bound_port; };
+
+        /*!
+         * \brief Convert a string to a valid metric name.
+         * \param name Name to convert.
+         * \return Name with invalid characters replaced by '_'.
+         */
+        static std::string metric_name(const std::string& name) {
+            std::string res = name;
+            for(std::size_t i = 0; i < res.size(); i++) {
+                const char c = res[i];
+                const bool alpha = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || c == ':';
+                if(!alpha && !(i > 0 && c >= '0' && c <= '9')) res[i] = '_';
+            }
+            return res;
+        };
+
+    private:
+        struct value_metric {
+            std::string name;
+            std::string help;
+            std::string type;
+            std::function<double(void)> read;
+        };
+
+        static std::string escape_label(const std::string& str) {
+            std::string res;
+            for(const char& c : str) {
+                if(c == '\\') res += "\\\\";
+                else if(c == '"') res += "\\\"";
+                else if(c == '\n') res += "\\n";
+                else res += c;
+            }
+            return res;
+        };
+
+        static std::string escape_help(const std::string& str) {
+            std::string res;
+            for(const char& c : str) {
+                if(c == '\\') res += "\\\\";
+                else if(c == '\n') res += "\\n";
+                else res += c;
+            }
+            return res;
+        };
+
+#if defined(WTF_PROMETHEUS_HTTP_SUPPORTED)
+        static constexpr int client_timeout_ms = 1000;  //  Longest wait on one client's request or response
+
+        //  Accept loop.  Polls so stop() is noticed without a connection arriving.
+        void serve(const int& fd) {
+            while(running.load()) {
+                pollfd pfd { fd, POLLIN, 0 };
+                if(::poll(&pfd, 1, 100) <= 0) continue;
+                const int client = ::accept(fd, nullptr, nullptr);
+                if(client < 0) continue;
+                //  A client that sends nothing or stops reading must not hold up stop().
+                timeval timeout { client_timeout_ms / 1000, (client_timeout_ms % 1000) * 1000 };
+                ::setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+                ::setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+                char request[1024];
+                const ssize_t got = ::recv(client, request, sizeof(request) - 1, 0);
+                std::string response;
+                if(got > 4 && std::strncmp(request, "GET ", 4) == 0) {
+                    const std::string body = render();
+                    response = "HTTP/1.1 200 OK\r\n"
+                               "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                               "Content-Length: " + std::to_string(body.size()) + "\r\n"
+                               "Connection: close\r\n\r\n" + body;
+                } else {
+                    response = "HTTP/1.1 405 Method Not Allowed\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+                }
+                send_all(client, response);
+                ::close(client);
+            }
+            ::close(fd);
+            bound_port = 0;
+        };
+
+        static void send_all(const int& fd, const std::string& data) {
+#if defined(MSG_NOSIGNAL)
+            const int flags = MSG_NOSIGNAL;
+#else
+            const int flags = 0;
+#endif
+            std::size_t sent = 0;
+            while(sent < data.size()) {
+                const ssize_t n = ::send(fd, data.data() + sent, data.size() - sent, flags);
+                if(n <= 0) return;
+                sent += static_cast<std::size_t>(n);
+            }
+        };
+#endif
+
+        const std::string metric_prefix;     //  Prefix for all metric names
+        latency_recorder& source;            //  Histograms to export
+        std::vector<double> bounds;          //  Histogram bucket bounds in seconds
+        std::vector<value_metric> values;    //  Counters and gauges
+        std::mutex exporter_mtx;             //  Guards bounds and values
+
+        std::thread worker;                  //  File writer or HTTP server
+        std::atomic<bool> running {false};   //  True while the worker should run
+        std::mutex stop_mtx;                 //  Used to wake the file writer
+        std::condition_variable stop_cv;
+        std::atomic<std::uint16_t> bound_port {0};
+};
+
+}  //  end namespace wtf
+
+#endif
@@ -0,0 +1,321 @@
+/*
+ * Sampling Profiler
+ * By:  Matthew Evans
+ * File:  sampling_profiler.hpp
+ * Version:  101826
+ *
+ * See LICENSE.md for copyright information.
+ *
+ * Signal driven sampling profiler for a single thread.
+ * A per thread CPU time timer (timer_create) sends SIGPROF to the thread
+ * being profiled.  The handler saves the instruction pointer and walks the
+ * frame pointer chain into a fixed size buffer owned by that thread.
+ * Nothing is allocated or locked in the handler.
+ *
+ * Results are written as folded stacks for flame graph tools:
+ * https://github.com/brendangregg/FlameGraph
+ *
+ * Only Linux on x86_64 and aarch64 is supported.  Elsewhere start() returns
+ * false.  Build with -fno-omit-frame-pointer for full stacks, otherwise
+ * only the sampled function is reliable.  Link with -rdynamic so functions
+ * in the executable have names, otherwise frames are written as
+ * module+offset for addr2line.  Older glibc also needs -ldl and -lrt.
+ *
+ * Example:
+ *
+ * wtf::sampling_profiler profiler(999);  //  Samples per second of CPU time
+ * profiler.start();
+ *   ~~~ do something ~~~
+ * profiler.stop();
+ * profiler.write_folded(std::cout, "My Benchmark");
+ *
+ */
+
+#ifndef WTF_SAMPLING_PROFILER_HPP
+#define WTF_SAMPLING_PROFILER_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <atomic>
+#include <mutex>
+#include <ostream>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+
+#if defined(__linux__) && (defined(__x86_64__) || defined(__aarch64__))
+#define WTF_SAMPLING_PROFILER_SUPPORTED 1
+#include <csignal>
+#include <ctime>
+#include <pthread.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <ucontext.h>
+#include <sys/syscall.h>
+#include <cxxabi.h>
+#endif
+
+namespace wtf {
+
+/*!
+ * \class sampling_profiler
+ * \brief Sample the call stack of the thread that starts it.
+ */
+class sampling_profiler {
+    public:
+        //!  Most frames kept per sample.
+        static constexpr std::size_t max_depth = 64;
+
+        /*!
+         * \brief Create the profiler.  Sample storage is allocated here.
+         * \param hz Samples per second of thread CPU time.
+         * \param capacity Samples kept before further samples are dropped.
+         */
+        sampling_profiler(const unsigned int& hz = 999, const std::size_t& capacity = 4096) :
+        frequency(hz == 0 ? 1 : hz), samples(capacity) {};
+
+        sampling_profiler() = delete;
+
+        ~sampling_profiler() { stop(); };  //!<  Stops sampling if running.
+
+        sampling_profiler(const sampling_profiler&) = delete;
+        sampling_profiler& operator=(const sampling_profiler&) = delete;
+
+        /*!
+         * \brief Start sampling the calling thread.
+         * \return False if sampling is not available.
+         */
+        bool start(void) {
+#if defined(WTF_SAMPLING_PROFILER_SUPPORTED)
+            if(running) return true;
+            install_handler();
+
+            //  Record the stack bounds so the handler only follows frame pointers into it.
+            pthread_attr_t attr;
+            if(pthread_getattr_np(pthread_self(), &attr) == 0) {
+                void* addr = nullptr;
+                std::size_t size = 0;
+                pthread_attr_getstack(&attr, &addr, &size);
+                pthread_attr_destroy(&attr);
+                stack_lo = reinterpret_cast<std::uintptr_t>(addr);
+                stack_hi = stack_lo + size;
+            }
+            active() = this;
+
+            sigevent sev;
+            std::memset(&sev, 0, sizeof(sev));
+            sev.sigev_notify = SIGEV_THREAD_ID;
+            sev.sigev_signo = SIGPROF;
+#if defined(sigev_notify_thread_id)
+            sev.sigev_notify_thread_id = static_cast<pid_t>(syscall(SYS_gettid));
+#else
+            sev._sigev_un._tid = static_cast<pid_t>(syscall(SYS_gettid));
+#endif
+            if(timer_create(CLOCK_THREAD_CPUTIME_ID, &sev, &timer) != 0) {
+                active() = nullptr;
+                return false;
+            }
+            itimerspec spec;
+            const long interval = 1000000000L / static_cast<long>(frequency);
+            spec.it_interval.tv_sec = interval / 1000000000L;
+            spec.it_interval.tv_nsec = interval % 1000000000L;
+            spec.it_value = spec.it_interval;
+            if(timer_settime(timer, 0, &spec, nullptr) != 0) {
+                timer_delete(timer);
+                active() = nullptr;
+                return false;
+            }
+            running = true;
+            return true;
+#else
+            return false;
+#endif
+        };
+
+        /*!
+         * \brief Stop sampling.  Must be called from the thread that started it.
+         */
+        void stop(void) {
+#if defined(WTF_SAMPLING_PROFILER_SUPPORTED)
+            if(!running) return;
+            timer_delete(timer);
+            running = false;
+            //  A signal may already be pending, so detach after the timer is gone.
+            if(active() == this) active() = nullptr;
+#endif
+        };
+
+        /*!
+         * \brief Discard all samples.  Call while stopped.
+         */
+        void clear(void) {
+            count.store(0, std::memory_order_relaxed);
+            dropped_count.store(0, std::memory_order_relaxed);
+        };
+
+        /*!
+         * \brief Number of samples taken.
+         * \return Sample count.
+         */
+        std::size_t size(void) const { return count.load(std::memory_order_acquire); };
+
+        /*!
+         * \brief Number of samples dropped because the buffer was full.
+         * \return Dropped sample count.
+         */
+        std::size_t dropped(void) const { return dropped_count.load(std::memory_order_relaxed); };
+
+        /*!
+         * \brief Collapse samples into folded stacks.
+         * May be called while sampling, reads the samples taken so far.
+         * \param root Optional frame placed at the root of every stack.
+         * \return Count for each distinct stack, frames separated by ';'.
+         */
+        std::map<std::string, std::uint64_t> folded(const std::string& root = "") const {
+            std::map<std::string, std::uint64_t> res;
+            std::map<std::uintptr_t, std::string> names;
+            const std::size_t total = size();
+            for(std::size_t i = 0; i < total; i++) {
+                const stack_sample& s = samples[i];
+                std::string line = root;
+                //  Frames are stored leaf first.
+                for(std::size_t f = s.depth; f > 0; f--) {
+                    //  Return addresses point after the call, look up the call itself.
+                    const std::uintptr_t addr = (f == 1) ? s.frames[0] : s.frames[f - 1] - 1;
+                    auto it = names.find(addr);
+                    if(it == names.end()) it = names.emplace(addr, symbol_name(addr)).first;
+                    if(!line.empty()) line += ';';
+                    line += it->second;
+                }
+                res[line]++;
+            }
+            return res;
+        };
+
+        /*!
+         * \brief Write folded stacks, one "frame;frame;frame count" per line.
+         * \param out Stream to write to.
+         * \param root Optional frame placed at the root of every stack.
+         */
+        void write_folded(std::ostream& out, const std::string& root = "") const {
+            for(auto& stack : folded(root)) out << stack.first << " " << stack.second << "\n";
+        };
+
+        /*!
+         * \brief Look up the name of the function containing an address.
+         * \param addr Code address.
+         * \return Demangled name, module+offset, or the address in hex.
+         */
+        static std::string symbol_name(const std::uintptr_t& addr) {
+            std::string res;
+#if defined(WTF_SAMPLING_PROFILER_SUPPORTED)
+            Dl_info info;
+            if(dladdr(reinterpret_cast<void*>(addr), &info) != 0) {
+                if(info.dli_sname != nullptr) {
+                    int status = 0;
+                    char* demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+                    res = (status == 0 && demangled != nullptr) ? demangled : info.dli_sname;
+                    std::free(demangled);
+                } else if(info.dli_fname != nullptr) {
+                    const char* base = std::strrchr(info.dli_fname, '/');
+                    char buf[32];
+                    std::snprintf(buf, sizeof(buf), "+0x%llx", static_cast<unsigned long long>(
+                        addr - reinterpret_cast<std::uintptr_t>(info.dli_fbase)));
+                    res = std::string(base == nullptr ? info.dli_fname : base + 1) + buf;
+                }
+            }
+#endif
+            if(res.empty()) {
+                char buf[32];
+                std::snprintf(buf, sizeof(buf), "0x%llx", static_cast<unsigned long long>(addr));
+                res = buf;
+            }
+            //  ';' separates frames in the folded format.
+            for(char& c : res) if(c == ';') c = ':';
+            return res;
+        };
+
+    private:
+        struct stack_sample {
+            std::size_t depth;
+            std::uintptr_t frames[max_depth];
+        };
+
+        //  Profiler receiving samples on this thread.
+        static sampling_profiler*& active(void) {
+            thread_local sampling_profiler* profiler = nullptr;
+            return profiler;
+        };
+
+#if defined(WTF_SAMPLING_PROFILER_SUPPORTED)
+        static void install_handler(void) {
+            static std::once_flag installed;
+            std::call_once(installed, [] {
+                struct sigaction sa;
+                std::memset(&sa, 0, sizeof(sa));
+                sa.sa_sigaction = &signal_handler;
+                sa.sa_flags = SA_SIGINFO | SA_RESTART;
+                sigemptyset(&sa.sa_mask);
+                sigaction(SIGPROF, &sa, nullptr);
+            });
+        };
+
+        static void signal_handler(int, siginfo_t*, void* context) {
+            sampling_profiler* profiler = active();
+            if(profiler == nullptr) return;
+            profiler->take_sample(static_cast<ucontext_t*>(context));
+        };
+
+        //  Runs in the signal handler.  Async signal safe.
+        void take_sample(const ucontext_t* uc) {
+            const std::size_t idx = count.load(std::memory_order_relaxed);
+            if(idx >= samples.size()) {
+                dropped_count.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            stack_sample& s = samples[idx];
+#if defined(__x86_64__)
+            std::uintptr_t ip = static_cast<std::uintptr_t>(uc->uc_mcontext.gregs[REG_RIP]);
+            std::uintptr_t fp = static_cast<std::uintptr_t>(uc->uc_mcontext.gregs[REG_RBP]);
+            std::uintptr_t sp = static_cast<std::uintptr_t>(uc->uc_mcontext.gregs[REG_RSP]);
+#else
+            std::uintptr_t ip = static_cast<std::uintptr_t>(uc->uc_mcontext.pc);
+            std::uintptr_t fp = static_cast<std::uintptr_t>(uc->uc_mcontext.regs[29]);
+            std::uintptr_t sp = static_cast<std::uintptr_t>(uc->uc_mcontext.sp);
+#endif
+            s.frames[0] = ip;
+            s.depth = 1;
+            //  Each frame holds the caller's frame pointer followed by the return address.
+            //  Stop at anything that does not look like a frame on this thread's stack.
+            while(s.depth < max_depth) {
+                if(fp < sp || fp < stack_lo || fp + 2 * sizeof(std::uintptr_t) > stack_hi) break;
+                if(fp % sizeof(std::uintptr_t) != 0) break;
+                const std::uintptr_t* frame = reinterpret_cast<const std::uintptr_t*>(fp);
+                const std::uintptr_t next_fp = frame[0];
+                const std::uintptr_t ret = frame[1];
+                if(ret == 0) break;
+                s.frames[s.depth++] = ret;
+                if(next_fp <= fp) break;
+                sp = fp;
+                fp = next_fp;
+            }
+            count.store(idx + 1, std::memory_order_release);
+        };
+
+        timer_t timer {};  //  Per thread CPU time timer
+#endif
+
+        unsigned int frequency;                  //  Samples per second
+        bool running = false;                    //  True while the timer is armed
+        std::uintptr_t stack_lo = 0;             //  Bounds of the profiled thread's stack
+        std::uintptr_t stack_hi = 0;
+        std::vector<stack_sample> samples;       //  Written only by the signal handler
+        std::atomic<std::size_t> count {0};      //  Samples written
+        std::atomic<std::size_t> dropped_count {0};  //  Samples lost to a full buffer
+};
+
+}  //  end namespace wtf
+
+#endif
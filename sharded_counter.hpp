@@ -0,0 +1,355 @@
+/*
+ * Sharded Counters
+ * By:  Matthew Evans
+ * File:  sharded_counter.hpp
+ * Version:  101826
+ *
+ * See LICENSE.md for copyright information.
+ *
+ * Event counters and gauges for tracking rates and levels next to timers.
+ * Each metric has one cache line padded slot per CPU.  Writers update the
+ * slot of the CPU they run on, so threads on different CPUs never share a
+ * cache line.  Readers sum the slots at any time without stopping writers.
+ *
+ *   sharded_counter   Monotonic event count, eg hashes done.
+ *   sharded_gauge     Current level, eg queue depth.
+ *
+ * counter_registry::report() logs every metric through benchmark_output.
+ * Counters are logged with the events since the previous report as items,
+ * so the log shows an item rate.  Gauges are logged with their value.
+ * With WTF_BENCHMARK_DISABLE the updates are empty and optimized away, so
+ * every value reads zero.  Switched off at run time, metrics keep counting
+ * but nothing is reported.  See benchmark_control.hpp.
+ *
+ * Example:
+ *
+ * wtf::sharded_counter& hashes = wtf::counter_registry::instance().counter("md5 hashes");
+ * wtf::sharded_gauge& depth = wtf::counter_registry::instance().gauge("queue depth");
+ * hashes.add();
+ * depth.add(1);
+ *   ~~~
+ * wtf::counter_registry::instance().start_reporting(std::chrono::seconds(10));
+ *
+ */
+
+#ifndef WTF_SHARDED_COUNTER_HPP
+#define WTF_SHARDED_COUNTER_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <cstdint>
+
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
+#include "benchmark_control.hpp"
+#include "benchmark_output.hpp"
+
+namespace wtf {
+
+namespace detail {
+
+//  Number of slots per metric.  A power of two at least the CPU count.
+inline std::size_t shard_count(void) {
+    static const std::size_t count = [] {
+        const std::size_t cpus = std::thread::hardware_concurrency();
+        std::size_t n = 1;
+        while(n < cpus) n <<= 1;
+        return n;
+    }();
+    return count;
+};
+
+//  Slot for the calling thread.  Uses the current CPU where available.
+inline std::size_t shard_index(void) noexcept {
+#if defined(__linux__)
+    const int cpu = sched_getcpu();
+    if(cpu >= 0) return static_cast<std::size_t>(cpu) & (shard_count() - 1);
+#endif
+    static std::atomic<std::size_t> next {0};
+    thread_local const std::size_t index = next.fetch_add(1, std::memory_order_relaxed);
+    return index & (shard_count() - 1);
+};
+
+//  Value padded to its own cache line.
+template <typename V>
+struct alignas(64) padded_slot {
+    std::atomic<V> value {0};
+};
+
+}  //  end namespace detail
+
+/*!
+ * \class sharded_counter
+ * \brief Monotonic event counter with one slot per CPU.
+ */
+class sharded_counter {
+    public:
+        sharded_counter() : slots(new detail::padded_slot<std::uint64_t>[detail::shard_count()]) {};
+        ~sharded_counter() = default;  //!<  Default destructor.
+
+        sharded_counter(const sharded_counter&) = delete;
+        sharded_counter& operator=(const sharded_counter&) = delete;
+
+        /*!
+         * \brief Count events.
+         * Does nothing when instrumentation is compiled out.
+         * \param n Number of events.
+         */
+        inline void add(const std::uint64_t& n = 1) noexcept {
+            //  Threads may move between CPUs, so slots still need an atomic add.
+            if constexpr(benchmark_compiled)
+                slots[detail::shard_index()].value.fetch_add(n, std::memory_order_relaxed);
+        };
+
+        /*!
+         * \brief Get the total count.
+         * \return Sum of all slots.
+         */
+        std::uint64_t value(void) const noexcept {
+            std::uint64_t res = 0;
+            for(std::size_t i = 0; i < detail::shard_count(); i++)
+                res += slots[i].value.load(std::memory_order_relaxed);
+            return res;
+        };
+
+    private:
+        std::unique_ptr<detail::padded_slot<std::uint64_t>[]> slots;
+};
+
+/*!
+ * \class sharded_gauge
+ * \brief Current level with one slot per CPU.
+ * add() and sub() may be called from any thread.  set() is meant for a
+ * single writer, adds racing with it may be lost.
+ */
+class sharded_gauge {
+    public:
+        sharded_gauge() : slots(new detail::padded_slot<std::int64_t>[detail::shard_count()]) {};
+        ~sharded_gauge() = default;  //!<  Default destructor.
+
+        sharded_gauge(const sharded_gauge&) = delete;
+        sharded_gauge& operator=(const sharded_gauge&) = delete;
+
+        /*!
+         * \brief Raise the level.
+         * Does nothing when instrumentation is compiled out.
+         * \param n Amount to add.
+         */
+        inline void add(const std::int64_t& n = 1) noexcept {
+            if constexpr(benchmark_compiled)
+                slots[detail::shard_index()].value.fetch_add(n, std::memory_order_relaxed);
+        };
+
+        /*!
+         * \brief Lower the level.
+         * \param n Amount to subtract.
+         */
+        inline void sub(const std::int64_t& n = 1) noexcept { add(-n); };
+
+        /*!
+         * \brief Set the level.
+         * Does nothing when instrumentation is compiled out.
+         * \param v New level.
+         */
+        void set(const std::int64_t& v) noexcept {
+            if constexpr(!benchmark_compiled) return;
+            for(std::size_t i = 1; i < detail::shard_count(); i++)
+                slots[i].value.store(0, std::memory_order_relaxed);
+            slots[0].value.store(v, std::memory_order_relaxed);
+        };
+
+        /*!
+         * \brief Get the current level.
+         * \return Sum of all slots.
+         */
+        std::int64_t value(void) const noexcept {
+            std::int64_t res = 0;
+            for(std::size_t i = 0; i < detail::shard_count(); i++)
+                res += slots[i].value.load(std::memory_order_relaxed);
+            return res;
+        };
+
+    private:
+        std::unique_ptr<detail::padded_slot<std::int64_t>[]> slots;
+};
+
+/*!
+ * \class counter_registry
+ * \brief Named counters and gauges, reported through benchmark_output.
+ */
+class counter_registry {
+    public:
+        /*!
+         * \brief Get the process wide registry.
+         * Never destroyed so threads may count during shutdown.
+         */
+        static counter_registry& instance(void) {
+            static counter_registry* registry = new counter_registry();
+            return *registry;
+        };
+
+        /*!
+         * \brief Get or create a counter.
+         * Keep the reference to avoid the lookup on the hot path.
+         * \param name Counter name.
+         * \return Reference to the counter.
+         */
+        sharded_counter& counter(const std::string& name) {
+            std::lock_guard<std::mutex> lock(registry_mtx);
+            auto it = counters.find(name);
+            if(it == counters.end())
+                it = counters.emplace(name, counter_entry { std::make_unique<sharded_counter>(), 0 }).first;
+            return *it->second.metric;
+        };
+
+        /*!
+         * \brief Get or create a gauge.
+         * Keep the reference to avoid the lookup on the hot path.
+         * \param name Gauge name.
+         * \return Reference to the gauge.
+         */
+        sharded_gauge& gauge(const std::string& name) {
+            std::lock_guard<std::mutex> lock(registry_mtx);
+            auto it = gauges.find(name);
+            if(it == gauges.end()) it = gauges.emplace(name, std::make_unique<sharded_gauge>()).first;
+            return *it->second;
+        };
+
+        /*!
+         * \brief Visit every counter.
+         * \param fn Called with each name and total.
+         */
+        void for_each_counter(const std::function<void(const std::string&, std::uint64_t)>& fn) const {
+            std::lock_guard<std::mutex> lock(registry_mtx);
+            for(auto& c : counters) fn(c.first, c.second.metric->value());
+        };
+
+        /*!
+         * \brief Visit every gauge.
+         * \param fn Called with each name and level.
+         */
+        void for_each_gauge(const std::function<void(const std::string&, std::int64_t)>& fn) const {
+            std::lock_guard<std::mutex> lock(registry_mtx);
+            for(auto& g : gauges) fn(g.first, g.second->value());
+        };
+
+        /*!
+         * \brief Log every counter and gauge through benchmark_output.
+         * Counter records cover the time since the previous report, with the
+         * events in that time as items.  The total is logged as a metric.
+         * Does nothing when instrumentation is off.
+         */
+        void report(void) {
+            if(!benchmark_enabled()) return;
+            std::vector<benchmark_record> recs;
+            {
+                std::lock_guard<std::mutex> lock(registry_mtx);
+                const auto now = std::chrono::system_clock::now();
+                const std::uint64_t tid = benchmark_output::thread_id();
+                for(auto& c : counters) {
+                    const std::uint64_t total = c.second.metric->value();
+                    benchmark_record rec = make_record(c.first, last_report, now, tid);
+                    rec.type = "counter";
+                    rec.items = total - c.second.reported;
+                    rec.metrics = { { "total", static_cast<double>(total) } };
+                    c.second.reported = total;
+                    recs.push_back(rec);
+                }
+                for(auto& g : gauges) {
+                    benchmark_record rec = make_record(g.first, now, now, tid);
+                    rec.type = "gauge";
+                    rec.metrics = { { "value", static_cast<double>(g.second->value()) } };
+                    recs.push_back(rec);
+                }
+                last_report = now;
+            }
+            for(auto& r : recs) benchmark_output::instance().write(r);
+        };
+
+        /*!
+         * \brief Start a thread calling report() on an interval.
+         * \param interval Time between reports.
+         * \return False if already reporting, or if instrumentation is compiled out.
+         */
+        bool start_reporting(const std::chrono::milliseconds& interval) {
+            if constexpr(!benchmark_compiled) return false;
+            std::lock_guard<std::mutex> guard(reporter_mtx);
+            if(reporting) return false;
+            reporting = true;
+            reporter = std::thread([this, interval] {
+                std::unique_lock<std::mutex> lock(reporter_mtx);
+                while(!reporter_cv.wait_for(lock, interval, [this] { return !reporting; })) {
+                    lock.unlock();
+                    report();
+                    benchmark_output::instance().flush();
+                    lock.lock();
+                }
+            });
+            return true;
+        };
+
+        /*!
+         * \brief Stop the reporting thread.
+         */
+        void stop_reporting(void) {
+            {
+                std::lock_guard<std::mutex> lock(reporter_mtx);
+                reporting = false;
+            }
+            reporter_cv.notify_all();
+            if(reporter.joinable()) reporter.join();
+        };
+
+    private:
+        counter_registry() = default;
+        ~counter_registry() = default;
+
+        struct counter_entry {
+            std::unique_ptr<sharded_counter> metric;
+            std::uint64_t reported;  //  Total at the previous report
+        };
+
+        static benchmark_record make_record(
+            const std::string& name,
+            const std::chrono::system_clock::time_point& start,
+            const std::chrono::system_clock::time_point& end,
+            const std::uint64_t& tid
+        ) {
+            benchmark_record rec;
+            rec.label = name;
+            rec.name = name;
+            rec.start = start;
+            rec.end = end;
+            rec.elapsed_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+            rec.elapsed = rec.elapsed_ns;
+            rec.self_ns = rec.elapsed_ns;
+            rec.self = rec.elapsed_ns;
+            rec.unit = "nanoseconds";
+            rec.thread_id = tid;
+            return rec;
+        };
+
+        mutable std::mutex registry_mtx;  //  Guards the metric maps
+        std::map<std::string, counter_entry> counters;
+        std::map<std::string, std::unique_ptr<sharded_gauge>> gauges;
+        std::chrono::system_clock::time_point last_report = std::chrono::system_clock::now();
+
+        std::mutex reporter_mtx;  //  Guards the reporting flag
+        std::condition_variable reporter_cv;
+        std::thread reporter;
+        bool reporting = false;
+};
+
+}  //  end namespace wtf
+
+#endif
@@ -0,0 +1,478 @@
+/*
+ * Shared Metrics
+ * By:  Matthew Evans
+ * File:  shared_metrics.hpp
+ * Version:  101826
+ *
+ * See LICENSE.md for copyright information.
+ *
+ * Publish each process's metrics to a POSIX shared memory region so one
+ * agent can read every worker without sockets or pipes.
+ *
+ * Each process owns a region named /<prefix>.<pid>, seen on Linux as
+ * /dev/shm/<prefix>.<pid>.  A publisher thread copies the latency_recorder
+ * histograms and the counter_registry counters and gauges into fixed slots
+ * on an interval.  Every slot is guarded by a seqlock:  the publisher is
+ * the only writer and never waits, readers retry if they see a write in
+ * progress.  Measurement threads are not involved.  Names longer than 63
+ * characters are truncated.
+ *
+ * The region is removed when the publisher is destroyed.  Regions left by
+ * crashed processes are skipped by readers, or removed with clean_stale.
+ * The header holds the process start time from /proc, so a region is not
+ * taken as live when its pid has been reused by another process.
+ * Linux only.  Older glibc needs -lrt.
+ *
+ * Example:
+ *
+ * //  In each worker
+ * wtf::shared_metrics_publisher publisher;
+ * publisher.start(std::chrono::seconds(1));
+ *
+ * //  In the agent, see tools/shared_metrics_reader.cpp
+ * for(auto& proc : wtf::read_all_shared_metrics()) ...
+ *
+ */
+
+#ifndef WTF_SHARED_METRICS_HPP
+#define WTF_SHARED_METRICS_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <stdexcept>
+
+#if defined(__linux__)
+#define WTF_SHARED_METRICS_SUPPORTED 1
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "latency_histogram.hpp"
+#include "sharded_counter.hpp"
+
+namespace wtf {
+
+//!  Kind of value held in a shared metric slot.
+enum class shared_metric_kind : std::uint32_t { empty = 0, histogram = 1, counter = 2, gauge = 3 };
+
+namespace detail {
+
+inline constexpr std::uint64_t shared_metrics_magic = 0x3230534D46545721ULL;  //  "!WTFMS02"
+inline constexpr std::size_t shared_metric_name_size = 64;
+//  Reader retries before giving up on a slot, eg if the writer died mid write.
+inline constexpr int shared_metric_retries = 1000;
+
+//  Fixed region header.  Written once before any slot.
+struct shared_metrics_header {
+    std::uint64_t magic;
+    std::uint32_t pid;
+    std::uint32_t histogram_slots;
+    std::uint32_t value_slots;
+    std::uint32_t bucket_count;
+    std::uint64_t start_time;              //  Process start time in clock ticks since boot, zero if unknown
+    std::atomic<std::int64_t> updated_ns;  //  Time of the last publish
+};
+
+//  Latency histogram slot.
+struct alignas(64) shared_histogram_slot {
+    std::atomic<std::uint64_t> seq;        //  Odd while being written
+    std::atomic<std::uint32_t> kind;
+    char name[shared_metric_name_size];    //  Written once before kind is set
+    std::atomic<std::uint64_t> total;
+    std::atomic<std::uint64_t> sum;
+    std::atomic<std::uint64_t> min;
+    std::atomic<std::uint64_t> max;
+    std::atomic<std::uint64_t> counts[latency_histogram::bucket_count];
+};
+
+//  Counter or gauge slot.
+struct alignas(64) shared_value_slot {
+    std::atomic<std::uint64_t> seq;
+    std::atomic<std::uint32_t> kind;
+    char name[shared_metric_name_size];
+    std::atomic<std::int64_t> value;
+};
+
+inline std::size_t shared_metrics_size(const std::size_t& histograms, const std::size_t& values) {
+    return sizeof(shared_histogram_slot) * (histograms + 1) + sizeof(shared_value_slot) * values;
+};
+
+//  Slots start one histogram slot into the region, after the header.
+inline shared_histogram_slot* histogram_slots(void* base) {
+    return reinterpret_cast<shared_histogram_slot*>(static_cast<char*>(base) + sizeof(shared_histogram_slot));
+};
+
+inline shared_value_slot* value_slots(void* base, const std::size_t& histograms) {
+    return reinterpret_cast<shared_value_slot*>(
+        static_cast<char*>(base) + sizeof(shared_histogram_slot) * (histograms + 1));
+};
+
+#if defined(WTF_SHARED_METRICS_SUPPORTED)
+//  Start time of a process in clock ticks since boot, field 22 of /proc/<pid>/stat.  Zero if unknown.
+inline std::uint64_t process_start_time(const std::uint32_t& pid) {
+    std::ifstream in("/proc/" + std::to_string(pid) + "/stat");
+    std::string stat;
+    if(!std::getline(in, stat)) return 0;
+    //  The command name may hold spaces, so count fields from its closing parenthesis.
+    const std::size_t close = stat.rfind(')');
+    if(close == std::string::npos) return 0;
+    std::istringstream fields(stat.substr(close + 1));
+    std::string field;
+    for(int i = 3; i <= 22; i++) if(!(fields >> field)) return 0;
+    return std::strtoull(field.c_str(), nullptr, 10);
+};
+#endif
+
+inline std::string shared_metrics_name(const std::string& prefix, const std::uint32_t& pid) {
+    return "/" + prefix + "." + std::to_string(pid);
+};
+
+}  //  end namespace detail
+
+/*!
+ * \class shared_metrics_publisher
+ * \brief Copy this process's metrics into its shared memory region.
+ */
+class shared_metrics_publisher {
+    public:
+        /*!
+         * \brief Create and map the region.
+         * \param histograms Most histogram labels published.
+         * \param values Most counters and gauges published.
+         * \param prefix Region name prefix.
+         * \throws std::runtime_error if the region can not be created.
+         */
+        shared_metrics_publisher(
+            const std::size_t& histograms = 64,
+            const std::size_t& values = 256,
+            const std::string& prefix = "wtf_metrics"
+        ) : histogram_count(histograms), value_count(values) {
+#if defined(WTF_SHARED_METRICS_SUPPORTED)
+            const std::uint32_t pid = static_cast<std::uint32_t>(::getpid());
+            region_name = detail::shared_metrics_name(prefix, pid);
+            region_size = detail::shared_metrics_size(histograms, values);
+            ::shm_unlink(region_name.c_str());  //  Left over from an earlier process with this pid
+            const int fd = ::shm_open(region_name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+            if(fd < 0) throw std::runtime_error("Unable to create shared metrics region:  " + region_name);
+            if(::ftruncate(fd, static_cast<off_t>(region_size)) != 0) {
+                ::close(fd);
+                ::shm_unlink(region_name.c_str());
+                throw std::runtime_error("Unable to size shared metrics region:  " + region_name);
+            }
+            region = ::mmap(nullptr, region_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            ::close(fd);
+            if(region == MAP_FAILED) {
+                region = nullptr;
+                ::shm_unlink(region_name.c_str());
+                throw std::runtime_error("Unable to map shared metrics region:  " + region_name);
+            }
+            //  New shared memory is zero filled, so every slot starts empty.
+            auto* header = static_cast<detail::shared_metrics_header*>(region);
+            header->pid = pid;
+            header->histogram_slots = static_cast<std::uint32_t>(histograms);
+            header->value_slots = static_cast<std::uint32_t>(values);
+            header->bucket_count = static_cast<std::uint32_t>(latency_histogram::bucket_count);
+            header->start_time = detail::process_start_time(pid);
+            std::atomic_thread_fence(std::memory_order_release);
+            header->magic = detail::shared_metrics_magic;
+#else
+            (void)prefix;
+#endif
+        };
+
+        //!  Stop publishing and remove the region.
+        ~shared_metrics_publisher() {
+            stop();
+#if defined(WTF_SHARED_METRICS_SUPPORTED)
+            if(region != nullptr) {
+                ::munmap(region, region_size);
+                ::shm_unlink(region_name.c_str());
+            }
+#endif
+        };
+
+        shared_metrics_publisher(const shared_metrics_publisher&) = delete;
+        shared_metrics_publisher& operator=(const shared_metrics_publisher&) = delete;
+
+        /*!
+         * \brief Copy all metrics into the region now.
+         * Labels beyond the slot counts are not published.
+         */
+        void publish(void) {
+            std::lock_guard<std::mutex> lock(publish_mtx);
+            if(region == nullptr) return;
+            latency_recorder& recorder = latency_recorder::instance();
+            for(auto& label : recorder.labels()) {
+                detail::shared_histogram_slot* slot = histogram_slot(label);
+                if(slot == nullptr) continue;
+                const latency_snapshot snap = recorder.snapshot(label);
+                const std::uint64_t seq = slot->seq.load(std::memory_order_relaxed);
+                slot->seq.store(seq + 1, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_release);
+                slot->total.store(snap.total, std::memory_order_relaxed);
+                slot->sum.store(snap.sum, std::memory_order_relaxed);
+                slot->min.store(snap.min, std::memory_order_relaxed);
+                slot->max.store(snap.max, std::memory_order_relaxed);
+                for(std::size_t i = 0; i < latency_histogram::bucket_count; i++)
+                    slot->counts[i].store(snap.counts[i], std::memory_order_relaxed);
+                slot->seq.store(seq + 2, std::memory_order_release);
+            }
+            counter_registry& counters = counter_registry::instance();
+            counters.for_each_counter([this](const std::string& name, std::uint64_t v) {
+                write_value(name, shared_metric_kind::counter, static_cast<std::int64_t>(v));
+            });
+            counters.for_each_gauge([this](const std::string& name, std::int64_t v) {
+                write_value(name, shared_metric_kind::gauge, v);
+            });
+            static_cast<detail::shared_metrics_header*>(region)->updated_ns.store(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::system_clock::now().time_since_epoch()).count(),
+                std::memory_order_release);
+        };
+
+        /*!
+         * \brief Start a thread calling publish() on an interval.
+         * \param interval Time between publishes.
+         * \return False if already running or shared memory is not supported.
+         */
+        bool start(const std::chrono::milliseconds& interval) {
+            std::lock_guard<std::mutex> guard(thread_mtx);
+            if(running || region == nullptr) return false;
+            running = true;
+            worker = std::thread([this, interval] {
+                std::unique_lock<std::mutex> lock(thread_mtx);
+                do {
+                    lock.unlock();
+                    publish();
+                    lock.lock();
+                } while(!thread_cv.wait_for(lock, interval, [this] { return !running; }));
+            });
+            return true;
+        };
+
+        /*!
+         * \brief Stop the publisher thread.  The region stays readable until destruction.
+         */
+        void stop(void) {
+            {
+                std::lock_guard<std::mutex> lock(thread_mtx);
+                running = false;
+            }
+            thread_cv.notify_all();
+            if(worker.joinable()) worker.join();
+        };
+
+        /*!
+         * \brief Get the region name.
+         * \return Name passed to shm_open, empty if not supported.
+         */
+        const std::string& name(void) const { return region_name; };
+
+    private:
+        //  Find or claim the slot for a label.  Called with the publish lock held.
+        detail::shared_histogram_slot* histogram_slot(const std::string& label) {
+            auto it = histogram_index.find(label);
+            if(it != histogram_index.end()) return &detail::histogram_slots(region)[it->second];
+            if(histogram_index.size() >= histogram_count) return nullptr;
+            const std::size_t idx = histogram_index.size();
+            histogram_index[label] = idx;
+            detail::shared_histogram_slot* slot = &detail::histogram_slots(region)[idx];
+            std::strncpy(slot->name, label.c_str(), detail::shared_metric_name_size - 1);
+            slot->kind.store(static_cast<std::uint32_t>(shared_metric_kind::histogram), std::memory_order_release);
+            return slot;
+        };
+
+        //  Write a counter or gauge.  Called with the publish lock held.
+        void write_value(const std::string& name, const shared_metric_kind& kind, const std::int64_t& v) {
+            const std::string key = std::to_string(static_cast<std::uint32_t>(kind)) + name;
+            auto it = value_index.find(key);
+            std::size_t idx = 0;
+            if(it != value_index.end()) {
+                idx = it->second;
+            } else {
+                if(value_index.size() >= value_count) return;
+                idx = value_index.size();
+                value_index[key] = idx;
+            }
+            detail::shared_value_slot* slot = &detail::value_slots(region, histogram_count)[idx];
+            if(it == value_index.end()) {
+                std::strncpy(slot->name, name.c_str(), detail::shared_metric_name_size - 1);
+                slot->kind.store(static_cast<std::uint32_t>(kind), std::memory_order_release);
+            }
+            const std::uint64_t seq = slot->seq.load(std::memory_order_relaxed);
+            slot->seq.store(seq + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            slot->value.store(v, std::memory_order_relaxed);
+            slot->seq.store(seq + 2, std::memory_order_release);
+        };
+
+        const std::size_t histogram_count;             //  Histogram slots in the region
+        const std::size_t value_count;                 //  Value slots in the region
+        std::string region_name;                       //  shm_open name
+        std::size_t region_size = 0;
+        void* region = nullptr;                        //  Mapped region, null if unsupported
+        std::map<std::string, std::size_t> histogram_index;  //  Label to slot
+        std::map<std::string, std::size_t> value_index;      //  Kind and name to slot
+        std::mutex publish_mtx;                        //  One writer at a time
+
+        std::thread worker;                            //  Publisher thread
+        std::mutex thread_mtx;
+        std::condition_variable thread_cv;
+        bool running = false;
+};
+
+/*!
+ * \struct shared_process_metrics
+ * \brief Metrics read from one process's region.
+ */
+struct shared_process_metrics {
+    std::uint32_t pid = 0;                  //!<  Process id.
+    bool alive = false;                     //!<  True if the process that wrote the region is still running.
+    std::int64_t updated_ns = 0;            //!<  Time of the last publish, ns since epoch.
+    std::map<std::string, latency_snapshot> histograms;  //!<  Histograms by label.
+    std::map<std::string, std::uint64_t> counters;       //!<  Counters by name.
+    std::map<std::string, std::int64_t> gauges;          //!<  Gauges by name.
+};
+
+/*!
+ * \brief Read one process's region.
+ * \param name Region name as passed to shm_open, eg "/wtf_metrics.1234".
+ * \return Metrics from the region.
+ * \throws std::runtime_error if the region can not be read or is not a metrics region.
+ */
+inline shared_process_metrics read_shared_metrics(const std::string& name) {
+    shared_process_metrics res;
+#if defined(WTF_SHARED_METRICS_SUPPORTED)
+    const int fd = ::shm_open(name.c_str(), O_RDONLY, 0);
+    if(fd < 0) throw std::runtime_error("Unable to open shared metrics region:  " + name);
+    struct stat st;
+    if(::fstat(fd, &st) != 0 || static_cast<std::size_t>(st.st_size) < sizeof(detail::shared_histogram_slot)) {
+        ::close(fd);
+        throw std::runtime_error("Not a shared metrics region:  " + name);
+    }
+    const std::size_t size = static_cast<std::size_t>(st.st_size);
+    void* base = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if(base == MAP_FAILED) throw std::runtime_error("Unable to map shared metrics region:  " + name);
+    auto* header = static_cast<const detail::shared_metrics_header*>(base);
+    if(header->magic != detail::shared_metrics_magic ||
+       header->bucket_count != latency_histogram::bucket_count ||
+       detail::shared_metrics_size(header->histogram_slots, header->value_slots) > size) {
+        ::munmap(base, size);
+        throw std::runtime_error("Not a shared metrics region:  " + name);
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    res.pid = header->pid;
+    res.alive = (::kill(static_cast<pid_t>(res.pid), 0) == 0 || errno == EPERM);
+    //  A different start time means the pid now belongs to another process.
+    if(res.alive && header->start_time != 0) {
+        const std::uint64_t started = detail::process_start_time(res.pid);
+        if(started != 0 && started != header->start_time) res.alive = false;
+    }
+    res.updated_ns = header->updated_ns.load(std::memory_order_acquire);
+
+    auto name_of = [](const char* str) {
+        return std::string(str, ::strnlen(str, detail::shared_metric_name_size));
+    };
+    for(std::size_t i = 0; i < header->histogram_slots; i++) {
+        const detail::shared_histogram_slot& slot = detail::histogram_slots(base)[i];
+        if(slot.kind.load(std::memory_order_acquire) == 0) break;  //  Slots are claimed in order
+        latency_snapshot snap;
+        bool consistent = false;
+        for(int attempt = 0; attempt < detail::shared_metric_retries && !consistent; attempt++) {
+            const std::uint64_t seq = slot.seq.load(std::memory_order_acquire);
+            if(seq & 1) {
+                std::this_thread::yield();
+                continue;
+            }
+            snap.total = slot.total.load(std::memory_order_relaxed);
+            snap.sum = slot.sum.load(std::memory_order_relaxed);
+            snap.min = slot.min.load(std::memory_order_relaxed);
+            snap.max = slot.max.load(std::memory_order_relaxed);
+            for(std::size_t b = 0; b < latency_histogram::bucket_count; b++)
+                snap.counts[b] = slot.counts[b].load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            consistent = (slot.seq.load(std::memory_order_relaxed) == seq);
+        }
+        if(consistent) res.histograms[name_of(slot.name)] = snap;
+    }
+    for(std::size_t i = 0; i < header->value_slots; i++) {
+        const detail::shared_value_slot& slot = detail::value_slots(base, header->histogram_slots)[i];
+        const auto kind = static_cast<shared_metric_kind>(slot.kind.load(std::memory_order_acquire));
+        if(kind == shared_metric_kind::empty) break;
+        std::int64_t value = 0;
+        bool consistent = false;
+        for(int attempt = 0; attempt < detail::shared_metric_retries && !consistent; attempt++) {
+            const std::uint64_t seq = slot.seq.load(std::memory_order_acquire);
+            if(seq & 1) {
+                std::this_thread::yield();
+                continue;
+            }
+            value = slot.value.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            consistent = (slot.seq.load(std::memory_order_relaxed) == seq);
+        }
+        if(!consistent) continue;
+        if(kind == shared_metric_kind::counter) res.counters[name_of(slot.name)] = static_cast<std::uint64_t>(value);
+        else res.gauges[name_of(slot.name)] = value;
+    }
+    ::munmap(base, size);
+#else
+    (void)name;
+    throw std::runtime_error("Shared metrics are not supported on this platform.");
+#endif
+    return res;
+};
+
+/*!
+ * \brief Read every process's region.
+ * Regions that can not be read are skipped.
+ * \param prefix Region name prefix.
+ * \param clean_stale True to remove regions of processes that are no longer running.
+ * \return Metrics for each process.
+ */
+inline std::vector<shared_process_metrics> read_all_shared_metrics(
+    const std::string& prefix = "wtf_metrics",
+    const bool& clean_stale = false
+) {
+    std::vector<shared_process_metrics> res;
+#if defined(WTF_SHARED_METRICS_SUPPORTED)
+    std::error_code ec;
+    for(auto& entry : std::filesystem::directory_iterator("/dev/shm", ec)) {
+        const std::string file = entry.path().filename().string();
+        if(file.rfind(prefix + ".", 0) != 0) continue;
+        try {
+            shared_process_metrics proc = read_shared_metrics("/" + file);
+            if(!proc.alive) {
+                if(clean_stale) ::shm_unlink(("/" + file).c_str());
+                continue;
+            }
+            res.push_back(std::move(proc));
+        } catch(const std::runtime_error&) {}
+    }
+#else
+    (void)prefix;
+    (void)clean_stale;
+#endif
+    return res;
+};
+
+}  //  end namespace wtf
+
+#endif
@@ -0,0 +1,180 @@
+/*
+ * Timer Calibration
+ * By:  Matthew Evans
+ * File:  timer_calibration.hpp
+ * Version:  101826
+ *
+ * See LICENSE.md for copyright information.
+ *
+ * Measure the cost and resolution of the clocks used for timing.
+ * Reading a clock is not free.  A timed region includes about one clock
+ * read, which is noise for long operations but can be most of the result
+ * for operations of a few hundred nanoseconds.
+ *
+ * Each clock is read back to back many times.  The overhead is the median
+ * gap between reads and the resolution is the smallest non zero gap, or the
+ * resolution reported by the system if that is coarser.
+ *
+ * Calibration runs once per process, on first use of timer_calibration(),
+ * and takes a few milliseconds.  The benchmark registry writes the results
+ * with the run metadata.  benchmark::subtract_timer_overhead() removes the
+ * overhead from a measurement.
+ *
+ * Example:
+ *
+ * for(auto& c : wtf::timer_calibration().clocks)
+ *     std::cout << c.name << ":  " << c.overhead_ns << " ns per read, " <<
+ *         c.resolution_ns << " ns resolution" << std::endl;
+ * wtf::benchmark_output::instance().write_metadata(wtf::timer_calibration().metadata());
+ *
+ */
+
+#ifndef WTF_TIMER_CALIBRATION_HPP
+#define WTF_TIMER_CALIBRATION_HPP
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <utility>
+#include <algorithm>
+#include <cstdint>
+
+#if defined(__linux__)
+#include <time.h>
+#endif
+
+namespace wtf {
+
+/*!
+ * \struct clock_calibration
+ * \brief Measured cost and resolution of one clock.
+ */
+struct clock_calibration {
+    std::string name;            //!<  Clock name.
+    double overhead_ns = 0.0;    //!<  Median time between back to back reads.
+    double min_ns = 0.0;         //!<  Fastest time between back to back reads.
+    double resolution_ns = 0.0;  //!<  Smallest step the clock was seen or reported to take.
+    bool steady = false;         //!<  True if the clock never goes backwards.
+};
+
+/*!
+ * \struct timer_calibrations
+ * \brief Calibration of every available clock.
+ */
+struct timer_calibrations {
+    std::vector<clock_calibration> clocks;  //!<  One entry per clock.
+
+    /*!
+     * \brief Find a clock by name.
+     * \param name Clock name, eg "system_clock".
+     * \return Pointer to the entry, or null if not calibrated.
+     */
+    const clock_calibration* find(const std::string& name) const {
+        for(auto& c : clocks) if(c.name == name) return &c;
+        return nullptr;
+    };
+
+    /*!
+     * \brief Get the results as key / value pairs for benchmark_output::write_metadata().
+     * \return Metadata.
+     */
+    std::vector<std::pair<std::string, std::string>> metadata(void) const {
+        std::vector<std::pair<std::string, std::string>> res;
+        for(auto& c : clocks) {
+            res.push_back({ c.name + "_overhead_ns", std::to_string(c.overhead_ns) });
+            res.push_back({ c.name + "_resolution_ns", std::to_string(c.resolution_ns) });
+        }
+        return res;
+    };
+};
+
+namespace detail {
+
+//  Reads per clock.  Enough for a stable median, few enough to stay fast.
+inline constexpr std::size_t calibration_reads = 20000;
+
+//  Read a clock back to back and summarize the gaps in nanoseconds.
+template <typename R>
+inline clock_calibration calibrate(const std::string& name, const bool& steady, const double& reported_ns, R&& read) {
+    std::vector<std::int64_t> gaps(calibration_reads);
+    std::int64_t last = read();
+    for(std::size_t i = 0; i < calibration_reads; i++) {
+        const std::int64_t now = read();
+        gaps[i] = now - last;
+        last = now;
+    }
+    clock_calibration res;
+    res.name = name;
+    res.steady = steady;
+    std::sort(gaps.begin(), gaps.end());
+    res.overhead_ns = static_cast<double>(gaps[gaps.size() / 2]);
+    res.min_ns = static_cast<double>(std::max<std::int64_t>(gaps.front(), 0));
+    const auto tick = std::upper_bound(gaps.begin(), gaps.end(), 0);
+    res.resolution_ns = std::max(tick == gaps.end() ? 0.0 : static_cast<double>(*tick), reported_ns);
+    return res;
+};
+
+template <typename C>
+inline clock_calibration calibrate_chrono(const std::string& name) {
+    const double period_ns = 1e9 * static_cast<double>(C::period::num) / static_cast<double>(C::period::den);
+    return calibrate(name, C::is_steady, period_ns, [] {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(C::now().time_since_epoch()).count();
+    });
+};
+
+#if defined(__linux__)
+inline clock_calibration calibrate_posix(const std::string& name, const clockid_t& id, const bool& steady) {
+    timespec res;
+    const double reported_ns = clock_getres(id, &res) == 0 ?
+        static_cast<double>(res.tv_sec) * 1e9 + static_cast<double>(res.tv_nsec) : 0.0;
+    return calibrate(name, steady, reported_ns, [id] {
+        timespec ts;
+        clock_gettime(id, &ts);
+        return static_cast<std::int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+    });
+};
+#endif
+
+}  //  end namespace detail
+
+/*!
+ * \brief Calibrate every available clock.
+ * Runs each time it is called, see timer_calibration() for the cached result.
+ * \return Calibration results.
+ */
+inline timer_calibrations calibrate_timers(void) {
+    timer_calibrations res;
+    //  Warm up so the first clock measured is not charged for page faults.
+    detail::calibrate_chrono<std::chrono::system_clock>("system_clock");
+    res.clocks.push_back(detail::calibrate_chrono<std::chrono::system_clock>("system_clock"));
+    res.clocks.push_back(detail::calibrate_chrono<std::chrono::steady_clock>("steady_clock"));
+    res.clocks.push_back(detail::calibrate_chrono<std::chrono::high_resolution_clock>("high_resolution_clock"));
+#if defined(__linux__)
+    res.clocks.push_back(detail::calibrate_posix("monotonic_raw", CLOCK_MONOTONIC_RAW, true));
+    res.clocks.push_back(detail::calibrate_posix("thread_cputime", CLOCK_THREAD_CPUTIME_ID, true));
+#endif
+    return res;
+};
+
+/*!
+ * \brief Get the calibration for this process, measured on first call.
+ * \return Calibration results.
+ */
+inline const timer_calibrations& timer_calibration(void) {
+    static const timer_calibrations calibration = calibrate_timers();
+    return calibration;
+};
+
+/*!
+ * \brief Get the overhead included in a region timed with system_clock.
+ * This is what benchmark::subtract_timer_overhead() removes.
+ * \return Nanoseconds.
+ */
+inline std::int64_t timer_overhead_ns(void) {
+    const clock_calibration* c = timer_calibration().find("system_clock");
+    return c == nullptr ? 0 : static_cast<std::int64_t>(c->overhead_ns);
+};
+
+}  //  end namespace wtf
+
+#endif
@@ -0,0 +1,380 @@
+/*
+ * Time Series Recorder
+ * By:  Matthew Evans
+ * File:  timeseries_recorder.hpp
+ * Version:  101826
+ *
+ * See LICENSE.md for copyright information.
+ *
+ * Record latency histograms over fixed time windows for long running tests.
+ * A background thread wakes once per window, snapshots every label in the
+ * latency_recorder and writes the change since the previous window to a
+ * binary file.  Only the previous snapshot of each label is kept, so memory
+ * does not grow with run length.  Code calling benchmark::record() is not
+ * changed or slowed down.
+ *
+ * File format, all integers after the header are LEB128 varints:
+ *
+ *   header   "WTFTS001", window length in ns, start time in ns since epoch
+ *   label    1, label id, length, bytes          (once per label)
+ *   window   2, label id, start ns, count, sum, min, max, bucket entries,
+ *            then for each entry:  bucket index delta, count
+ *
+ * Labels longer than 4096 bytes are not recorded, and a longer length in
+ * a file is read as corruption.
+ *
+ * Each window is flushed as it is written, so a file from a killed run
+ * can still be read up to the last full window.
+ *
+ * Windows are read back sparse, keeping only the buckets they used.  For
+ * very long runs, scan_timeseries() and merge_timeseries() read the file
+ * one window at a time instead of loading every window.
+ *
+ * Example:
+ *
+ * wtf::timeseries_recorder series("benchmark/soak.wts", std::chrono::seconds(1));
+ * series.start();
+ *   ~~~ run for hours, timing with benchmark::record() ~~~
+ * series.stop();
+ *
+ * wtf::latency_snapshot hour = wtf::merge_timeseries("benchmark/soak.wts", "md5", from_ns, to_ns);
+ *
+ * auto windows = wtf::read_timeseries("benchmark/soak.wts");
+ * wtf::latency_snapshot all = wtf::merge_windows(windows, "md5");
+ *
+ */
+
+#ifndef WTF_TIMESERIES_RECORDER_HPP
+#define WTF_TIMESERIES_RECORDER_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <filesystem>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <limits>
+#include <algorithm>
+#include <utility>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+#include "latency_histogram.hpp"
+#include "varint.hpp"
+
+namespace wtf {
+
+/*!
+ * \struct timeseries_window
+ * \brief Values recorded under one label during one window.
+ */
+struct timeseries_window {
+    std::string label;           //!<  Series label.
+    std::int64_t start_ns = 0;   //!<  Window start in nanoseconds since epoch.
+    std::int64_t length_ns = 0;  //!<  Window length in nanoseconds.
+    std::uint64_t total = 0;     //!<  Number of values recorded in the window.
+    std::uint64_t sum = 0;       //!<  Sum of values recorded in the window.
+    std::uint64_t min = std::numeric_limits<std::uint64_t>::max();  //!<  Smallest value.
+    std::uint64_t max = 0;       //!<  Largest value.
+    std::vector<std::pair<std::size_t, std::uint64_t>> buckets;  //!<  Index and count of each bucket used.
+
+    /*!
+     * \brief Add the window's values to a snapshot.
+     * \param snap Snapshot to add to.
+     */
+    void merge_into(latency_snapshot& snap) const {
+        for(auto& b : buckets) snap.counts[b.first] += b.second;
+        snap.merge_totals(total, sum, min, max);
+    };
+
+    /*!
+     * \brief Get the window as a full histogram.
+     * \return Snapshot of the window's values.
+     */
+    latency_snapshot snapshot(void) const {
+        latency_snapshot snap;
+        merge_into(snap);
+        return snap;
+    };
+};
+
+namespace detail {
+
+inline constexpr char timeseries_magic[8] = { 'W', 'T', 'F', 'T', 'S', '0', '0', '1' };
+
+//  Longest label written or read.  Longer lengths in a file mean it is corrupt.
+inline constexpr std::uint64_t timeseries_max_label = 4096;
+
+}  //  end namespace detail
+
+/*!
+ * \class timeseries_recorder
+ * \brief Write per window latency histograms to a binary file.
+ */
+class timeseries_recorder {
+    public:
+        /*!
+         * \brief Open the output file and write the header.
+         * \param path File to write, replaced if it exists.
+         * \param window Window length.
+         * \param recorder Latency recorder to read from.
+         * \throws std::runtime_error if the file can not be opened.
+         */
+        timeseries_recorder(
+            const std::string& path,
+            const std::chrono::nanoseconds& window = std::chrono::seconds(1),
+            latency_recorder& recorder = latency_recorder::instance()
+        ) : source(recorder), window_length(window.count() > 0 ? window : std::chrono::seconds(1)) {
+            const std::filesystem::path parent = std::filesystem::path(path).parent_path();
+            std::error_code ec;
+            if(!parent.empty()) std::filesystem::create_directories(parent, ec);
+            file.open(path, std::ios::trunc | std::ios::binary);
+            if(!file.is_open()) throw std::runtime_error("Unable to open time series file:  " + path);
+        };
+
+        timeseries_recorder() = delete;           //!<  Delete default constructor.
+        ~timeseries_recorder() { stop(); };       //!<  Stops recording, writing the last window.
+
+        timeseries_recorder(const timeseries_recorder&) = delete;
+        timeseries_recorder& operator=(const timeseries_recorder&) = delete;
+
+        /*!
+         * \brief Start the window thread.
+         * Values recorded before this are not counted.
+         * \return False if already running.
+         */
+        bool start(void) {
+            std::lock_guard<std::mutex> guard(window_mtx);
+            if(running) return false;
+            running = true;
+            window_start = std::chrono::system_clock::now();
+            if(!header_written) {
+                std::string header(detail::timeseries_magic, sizeof(detail::timeseries_magic));
+                detail::write_varint(header, static_cast<std::uint64_t>(window_length.count()));
+                detail::write_varint(header, static_cast<std::uint64_t>(epoch_ns(window_start)));
+                file.write(header.data(), header.size());
+                header_written = true;
+            }
+            //  Start from the current totals so earlier values are not counted.
+            for(auto& label : source.labels()) previous[label] = source.snapshot(label);
+            worker = std::thread([this] {
+                std::unique_lock<std::mutex> lock(window_mtx);
+                auto next = std::chrono::steady_clock::now() + window_length;
+                while(!window_cv.wait_until(lock, next, [this] { return !running; })) {
+                    write_window();
+                    next += window_length;
+                }
+                write_window();
+            });
+            return true;
+        };
+
+        /*!
+         * \brief Stop the window thread, writing the final partial window.
+         */
+        void stop(void) {
+            {
+                std::lock_guard<std::mutex> lock(window_mtx);
+                running = false;
+            }
+            window_cv.notify_all();
+            if(worker.joinable()) worker.join();
+        };
+
+    private:
+        static std::int64_t epoch_ns(const std::chrono::system_clock::time_point& t) {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(t.time_since_epoch()).count();
+        };
+
+        //  Write the change in every label since the last window.  Called with the lock held.
+        void write_window(void) {
+            const auto now = std::chrono::system_clock::now();
+            std::string out;
+            for(auto& label : source.labels()) {
+                if(label.size() > detail::timeseries_max_label) continue;
+                const latency_snapshot snap = source.snapshot(label);
+                latency_snapshot& prev = previous[label];
+                auto id = label_ids.find(label);
+                std::uint64_t total = 0;
+                std::size_t entries = 0, lo = snap.counts.size(), hi = 0;
+                for(std::size_t i = 0; i < snap.counts.size(); i++) {
+                    if(snap.counts[i] == prev.counts[i]) continue;
+                    total += snap.counts[i] - prev.counts[i];
+                    entries++;
+                    if(i < lo) lo = i;
+                    hi = i;
+                }
+                if(total == 0) {
+                    prev = snap;
+                    continue;
+                }
+                if(id == label_ids.end()) {
+                    id = label_ids.emplace(label, label_ids.size()).first;
+                    detail::write_varint(out, 1);
+                    detail::write_varint(out, id->second);
+                    detail::write_varint(out, label.size());
+                    out += label;
+                }
+                //  Window min and max come from the lowest and highest buckets used.
+                const std::uint64_t min = lo == 0 ? 0 : latency_histogram::bucket_upper(lo - 1) + 1;
+                const std::uint64_t max = std::min(latency_histogram::bucket_upper(hi), snap.max);
+                detail::write_varint(out, 2);
+                detail::write_varint(out, id->second);
+                detail::write_varint(out, static_cast<std::uint64_t>(epoch_ns(window_start)));
+                detail::write_varint(out, total);
+                detail::write_varint(out, snap.sum - prev.sum);
+                detail::write_varint(out, min);
+                detail::write_varint(out, max);
+                detail::write_varint(out, entries);
+                std::size_t last = 0;
+                for(std::size_t i = lo; i <= hi; i++) {
+                    if(snap.counts[i] == prev.counts[i]) continue;
+                    detail::write_varint(out, i - last);
+                    detail::write_varint(out, snap.counts[i] - prev.counts[i]);
+                    last = i;
+                }
+                prev = snap;
+            }
+            window_start = now;
+            if(out.empty()) return;
+            file.write(out.data(), out.size());
+            file.flush();
+        };
+
+        latency_recorder& source;                          //  Histograms to read
+        const std::chrono::nanoseconds window_length;      //  Length of each window
+        std::ofstream file;                                //  Output file
+        bool header_written = false;
+        std::map<std::string, latency_snapshot> previous;  //  Totals at the end of the last window
+        std::map<std::string, std::uint64_t> label_ids;    //  Labels already written to the file
+        std::chrono::system_clock::time_point window_start;
+
+        std::thread worker;                                //  Window thread
+        std::mutex window_mtx;                             //  Guards the file and state above
+        std::condition_variable window_cv;
+        bool running = false;
+};
+
+/*!
+ * \brief Read a time series file one window at a time.
+ * The window passed to the callback is reused, copy it to keep it.
+ * A truncated final record is ignored.
+ * \param path File to read.
+ * \param fn Called with each window in file order.
+ * \throws std::runtime_error if the file can not be opened or is not a time series file.
+ */
+template <typename F>
+inline void scan_timeseries(const std::string& path, F&& fn) {
+    std::ifstream in(path, std::ios::binary);
+    if(!in.is_open()) throw std::runtime_error("Unable to open time series file:  " + path);
+    char magic[sizeof(detail::timeseries_magic)];
+    std::uint64_t length = 0, start = 0;
+    if(!in.read(magic, sizeof(magic)) ||
+       std::memcmp(magic, detail::timeseries_magic, sizeof(magic)) != 0 ||
+       !detail::read_varint(in, length) || !detail::read_varint(in, start))
+        throw std::runtime_error("Not a time series file:  " + path);
+
+    std::map<std::uint64_t, std::string> labels;
+    timeseries_window w;
+    std::uint64_t type = 0;
+    while(detail::read_varint(in, type)) {
+        if(type == 1) {
+            std::uint64_t id = 0, size = 0;
+            if(!detail::read_varint(in, id) || !detail::read_varint(in, size)) break;
+            if(size > detail::timeseries_max_label) throw std::runtime_error("Corrupt time series file:  " + path);
+            std::string label(size, '\0');
+            if(!in.read(&label[0], size)) break;
+            labels[id] = label;
+        } else if(type == 2) {
+            std::uint64_t id = 0, win_start = 0, entries = 0;
+            if(!detail::read_varint(in, id) || !detail::read_varint(in, win_start) ||
+               !detail::read_varint(in, w.total) || !detail::read_varint(in, w.sum) ||
+               !detail::read_varint(in, w.min) || !detail::read_varint(in, w.max) ||
+               !detail::read_varint(in, entries)) break;
+            bool complete = true;
+            std::uint64_t index = 0;
+            w.buckets.clear();
+            for(std::uint64_t e = 0; e < entries && complete; e++) {
+                std::uint64_t delta = 0, count = 0;
+                complete = detail::read_varint(in, delta) && detail::read_varint(in, count);
+                index += delta;
+                if(complete && index < latency_histogram::bucket_count)
+                    w.buckets.emplace_back(static_cast<std::size_t>(index), count);
+            }
+            if(!complete) break;
+            w.label = labels[id];
+            w.start_ns = static_cast<std::int64_t>(win_start);
+            w.length_ns = static_cast<std::int64_t>(length);
+            fn(static_cast<const timeseries_window&>(w));
+        } else {
+            throw std::runtime_error("Corrupt time series file:  " + path);
+        }
+    }
+};
+
+/*!
+ * \brief Read a time series file.
+ * A truncated final record is ignored.
+ * \param path File to read.
+ * \return All windows in file order.
+ * \throws std::runtime_error if the file can not be opened or is not a time series file.
+ */
+inline std::vector<timeseries_window> read_timeseries(const std::string& path) {
+    std::vector<timeseries_window> res;
+    scan_timeseries(path, [&res](const timeseries_window& w) { res.push_back(w); });
+    return res;
+};
+
+/*!
+ * \brief Merge the windows for a label over a time range.
+ * \param windows Windows from read_timeseries().
+ * \param label Series label.
+ * \param from_ns Include windows starting at or after this time.
+ * \param to_ns Include windows starting before this time.
+ * \return Merged histogram.
+ */
+inline latency_snapshot merge_windows(
+    const std::vector<timeseries_window>& windows,
+    const std::string& label,
+    const std::int64_t& from_ns = std::numeric_limits<std::int64_t>::min(),
+    const std::int64_t& to_ns = std::numeric_limits<std::int64_t>::max()
+) {
+    latency_snapshot res;
+    for(auto& w : windows) {
+        if(w.label != label || w.start_ns < from_ns || w.start_ns >= to_ns) continue;
+        w.merge_into(res);
+    }
+    return res;
+};
+
+/*!
+ * \brief Merge the windows for a label over a time range straight from a file.
+ * Only one window is held at a time.
+ * \param path File to read.
+ * \param label Series label.
+ * \param from_ns Include windows starting at or after this time.
+ * \param to_ns Include windows starting before this time.
+ * \return Merged histogram.
+ * \throws std::runtime_error if the file can not be opened or is not a time series file.
+ */
+inline latency_snapshot merge_timeseries(
+    const std::string& path,
+    const std::string& label,
+    const std::int64_t& from_ns = std::numeric_limits<std::int64_t>::min(),
+    const std::int64_t& to_ns = std::numeric_limits<std::int64_t>::max()
+) {
+    latency_snapshot res;
+    scan_timeseries(path, [&](const timeseries_window& w) {
+        if(w.label != label || w.start_ns < from_ns || w.start_ns >= to_ns) return;
+        w.merge_into(res);
+    });
+    return res;
+};
+
+}  //  end namespace wtf
+
+#endif
@@ -0,0 +1,91 @@
+/*
+ * Benchmark Comparison Tool
+ * By:  Matthew Evans
+ * File:  benchmark_compare.cpp
+ * Version:  101826
+ *
+ * See LICENSE.md for copyright information.
+ *
+ * Compare two benchmark logs and report regressions.
+ * Exits with 1 if any benchmark regressed, so it can gate a release.
+ * Exits with 3 if none regressed but some had too few samples to tell,
+ * eg one run per log.  Use --repetitions with the registry for more.
+ * Exits with 2 on bad options or unreadable logs.
+ *
+ * Build:
+ *
+ * g++ -std=c++17 -O2 -I.. benchmark_compare.cpp -o benchmark_compare
+ *
+ * Usage:
+ *
+ * benchmark_compare base.jsonl new.jsonl [--threshold=5] [--alpha=0.05]
+ *
+ */
+
+#include <iostream>
+#include <string>
+#include <cmath>
+#include <cstdlib>
+
+#include "benchmark_compare.hpp"
+
+namespace {
+
+//  Parse a whole option value as a finite number.
+bool parse_number(const std::string& text, double& value) {
+    char* end = nullptr;
+    value = std::strtod(text.c_str(), &end);
+    return !text.empty() && *end == '\0' && std::isfinite(value);
+}
+
+//  Print the usage, returning the exit code.
+int usage(const char* program) {
+    std::cerr << "Usage:  " << program << " base_results new_results [--threshold=PCT] [--alpha=P]" << std::endl;
+    return 2;
+}
+
+}  //  end namespace
+
+int main(int argc, char* argv[]) {
+    double threshold = 5.0;
+    double alpha = 0.05;
+    std::string files[2];
+    int file_count = 0;
+
+    for(int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        if(arg.rfind("--threshold=", 0) == 0) {
+            if(!parse_number(arg.substr(12), threshold)) {
+                std::cerr << "Invalid threshold:  " << arg.substr(12) << std::endl;
+                return usage(argv[0]);
+            }
+        }
+        else if(arg.rfind("--alpha=", 0) == 0) {
+            if(!parse_number(arg.substr(8), alpha) || alpha <= 0.0 || alpha >= 1.0) {
+                std::cerr << "Invalid alpha:  " << arg.substr(8) << std::endl;
+                return usage(argv[0]);
+            }
+        }
+        else if(arg.rfind("--", 0) == 0) {
+            std::cerr << "Unknown option:  " << arg << std::endl;
+            return usage(argv[0]);
+        }
+        else if(file_count < 2) files[file_count++] = arg;
+        else return usage(argv[0]);
+    }
+    if(file_count != 2) return usage(argv[0]);
+
+    try {
+        const auto res = wtf::compare_benchmarks(
+            wtf::load_benchmark_results(files[0]),
+            wtf::load_benchmark_results(files[1]),
+            threshold, alpha);
+        wtf::print_comparison(std::cout, res);
+        for(auto& cmp : res) if(cmp.regression) return 1;
+        for(auto& cmp : res) if(cmp.insufficient) return 3;
+    } catch(const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 2;
+    }
+    return 0;
+}
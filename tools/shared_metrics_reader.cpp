@@ -0,0 +1,84 @@
+/*
+ * Shared Metrics Reader
+ * By:  Matthew Evans
+ * File:  shared_metrics_reader.cpp
+ * Version:  101826
+ *
+ * See LICENSE.md for copyright information.
+ *
+ * Read the shared metrics regions of every running process and print
+ * histograms, counters and gauges merged across processes.
+ *
+ * Build:
+ *
+ * g++ -std=c++17 -O2 -I.. shared_metrics_reader.cpp -o shared_metrics_reader
+ *
+ * Usage:
+ *
+ * shared_metrics_reader [--prefix=wtf_metrics] [--per-process] [--clean]
+ *
+ */
+
+#include <iostream>
+#include <string>
+#include <map>
+
+#include "shared_metrics.hpp"
+
+namespace {
+
+//  Print one set of metrics.
+void print_metrics(
+    const std::map<std::string, wtf::latency_snapshot>& histograms,
+    const std::map<std::string, std::uint64_t>& counters,
+    const std::map<std::string, std::int64_t>& gauges
+) {
+    for(auto& h : histograms) {
+        const wtf::latency_snapshot& snap = h.second;
+        if(snap.total == 0) continue;
+        std::cout << "Histogram:  " << h.first << std::endl;
+        snap.write_summary(std::cout);
+        std::cout << std::endl;
+    }
+    for(auto& c : counters) std::cout << "Counter:  " << c.first << " = " << c.second << std::endl;
+    for(auto& g : gauges) std::cout << "Gauge:  " << g.first << " = " << g.second << std::endl;
+}
+
+}  //  end namespace
+
+int main(int argc, char* argv[]) {
+    std::string prefix = "wtf_metrics";
+    bool per_process = false;
+    bool clean = false;
+
+    for(int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        if(arg.rfind("--prefix=", 0) == 0) prefix = arg.substr(9);
+        else if(arg == "--per-process") per_process = true;
+        else if(arg == "--clean") clean = true;
+        else {
+            std::cerr << "Usage:  " << argv[0] << " [--prefix=NAME] [--per-process] [--clean]" << std::endl;
+            return 2;
+        }
+    }
+
+    const auto procs = wtf::read_all_shared_metrics(prefix, clean);
+    std::cout << "Processes:  " << procs.size() << std::endl << std::endl;
+
+    std::map<std::string, wtf::latency_snapshot> histograms;
+    std::map<std::string, std::uint64_t> counters;
+    std::map<std::string, std::int64_t> gauges;
+    for(auto& proc : procs) {
+        if(per_process) {
+            std::cout << "Process:  " << proc.pid << std::endl << std::endl;
+            print_metrics(proc.histograms, proc.counters, proc.gauges);
+            std::cout << std::endl;
+            continue;
+        }
+        for(auto& h : proc.histograms) histograms[h.first].merge(h.second);
+        for(auto& c : proc.counters) counters[c.first] += c.second;
+        for(auto& g : proc.gauges) gauges[g.first] += g.second;
+    }
+    if(!per_process) print_metrics(histograms, counters, gauges);
+    return 0;
+}
@@ -0,0 +1,52 @@
+/*
+ * Varint
+ * By:  Matthew Evans
+ * File:  varint.hpp
+ * Version:  101826
+ *
+ * See LICENSE.md for copyright information.
+ *
+ * LEB128 unsigned varints shared by the binary file formats, see
+ * timeseries_recorder.hpp and workload_trace.hpp.  Each byte carries seven
+ * bits of the value, low bits first, with the high bit set on every byte
+ * but the last.
+ *
+ */
+
+#ifndef WTF_VARINT_HPP
+#define WTF_VARINT_HPP
+
+#include <string>
+#include <istream>
+#include <cstdint>
+
+namespace wtf {
+
+namespace detail {
+
+//  Append a value to a buffer.
+inline void write_varint(std::string& out, std::uint64_t v) {
+    while(v >= 0x80) {
+        out += static_cast<char>((v & 0x7F) | 0x80);
+        v >>= 7;
+    }
+    out += static_cast<char>(v);
+};
+
+//  Read a value from a stream.  False at end of stream or on a value over 64 bits.
+inline bool read_varint(std::istream& in, std::uint64_t& v) {
+    v = 0;
+    for(int shift = 0; shift < 64; shift += 7) {
+        const int c = in.get();
+        if(c == std::char_traits<char>::eof()) return false;
+        v |= static_cast<std::uint64_t>(c & 0x7F) << shift;
+        if((c & 0x80) == 0) return true;
+    }
+    return false;
+};
+
+}  //  end namespace detail
+
+}  //  end namespace wtf
+
+#endif
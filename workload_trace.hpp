@@ -0,0 +1,463 @@
+/*
+ * Workload Trace
+ * By:  Matthew Evans
+ * File:  workload_trace.hpp
+ * Version:  101826
+ *
+ * See LICENSE.md for copyright information.
+ *
+ * Capture hashing and terrain requests from a real run and replay them as
+ * a benchmark.  Optimizations can then be checked against the sizes and
+ * mix of work the program actually does instead of a synthetic loop.
+ *
+ * Only the shape of the work is kept:  md5_hasher update sizes, and the
+ * factor, offset and seed of each diamond_square map.  Hashed data is not
+ * stored, replay hashes a fixed pattern of the same sizes.
+ *
+ * File format, all integers after the magic are LEB128 varints:
+ *
+ *   header     "WTFWL001", start time in ns since epoch
+ *   event      op, ns since the previous event, then by op:
+ *                1  md5 begin       session
+ *                2  md5 update      session, bytes
+ *                3  md5 finalize    session
+ *                4  terrain         precision, factor, seed, offset as IEEE double bits
+ *
+ * Events are buffered and written in blocks.  A truncated final event is
+ * ignored when reading.
+ *
+ * Replay runs the events in order on the calling thread, either as fast as
+ * possible or at the recorded pace.  The run is logged as one benchmark with
+ * the bytes hashed and events replayed, and each operation's latency is added
+ * to the latency_recorder under "label/md5 update", "label/md5 finalize" and
+ * "label/terrain".
+ *
+ * Example:
+ *
+ * wtf::workload_trace_writer trace("benchmark/hash.wlt");
+ * wtf::traced_md5_hasher hasher(trace);       //  Drop in for md5_hasher
+ * hasher.initialize();
+ * hasher.update(buffer, len);
+ * hasher.finalize();
+ * trace.terrain<double>(8, 0.096, seed);      //  Before building the map
+ *
+ * wtf::replay_result res = wtf::replay_trace("hash replay", wtf::read_workload_trace("benchmark/hash.wlt"));
+ *
+ */
+
+#ifndef WTF_WORKLOAD_TRACE_HPP
+#define WTF_WORKLOAD_TRACE_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <filesystem>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <type_traits>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+#include "md5_hasher.hpp"
+#include "diamond_square.hpp"
+#include "benchmark.hpp"
+#include "benchmark_measure.hpp"
+#include "latency_histogram.hpp"
+#include "varint.hpp"
+
+namespace wtf {
+
+//!  Operations stored in a workload trace.
+enum class trace_op : std::uint8_t { md5_begin = 1, md5_update = 2, md5_finalize = 3, terrain = 4 };
+
+//!  Height map type of a terrain request.
+enum class trace_precision : std::uint8_t { float_map = 0, double_map = 1, long_double_map = 2 };
+
+/*!
+ * \struct trace_event
+ * \brief One operation read from a workload trace.
+ */
+struct trace_event {
+    trace_op op = trace_op::md5_begin;  //!<  Operation.
+    std::int64_t at_ns = 0;             //!<  Time since the trace started.
+    std::uint64_t session = 0;          //!<  Hash session, for md5 operations.
+    std::uint64_t bytes = 0;            //!<  Bytes passed to update.
+    std::size_t factor = 0;             //!<  Terrain size factor.
+    std::uint32_t seed = 0;             //!<  Terrain seed.
+    double offset = 0.0;                //!<  Terrain offset.
+    trace_precision precision = trace_precision::double_map;  //!<  Terrain height map type.
+};
+
+namespace detail {
+
+inline constexpr char workload_magic[8] = { 'W', 'T', 'F', 'W', 'L', '0', '0', '1' };
+
+inline std::uint64_t double_bits(const double& v) {
+    std::uint64_t bits;
+    std::memcpy(&bits, &v, sizeof(bits));
+    return bits;
+};
+
+inline double bits_double(const std::uint64_t& bits) {
+    double v;
+    std::memcpy(&v, &bits, sizeof(v));
+    return v;
+};
+
+}  //  end namespace detail
+
+/*!
+ * \class workload_trace_writer
+ * \brief Record hashing and terrain requests to a trace file.
+ * Safe to call from several threads.  Events are written in call order.
+ * Every call takes one writer wide mutex, including each update() of a
+ * traced_md5_hasher, so threads hashing through one writer serialize on it.
+ * Use a writer per thread where that matters.
+ */
+class workload_trace_writer {
+    public:
+        /*!
+         * \brief Open the trace file and write the header.
+         * \param path File to write, replaced if it exists.
+         * \throws std::runtime_error if the file can not be opened.
+         */
+        explicit workload_trace_writer(const std::string& path) : last(std::chrono::steady_clock::now()) {
+            const std::filesystem::path parent = std::filesystem::path(path).parent_path();
+            std::error_code ec;
+            if(!parent.empty()) std::filesystem::create_directories(parent, ec);
+            file.open(path, std::ios::trunc | std::ios::binary);
+            if(!file.is_open()) throw std::runtime_error("Unable to open workload trace:  " + path);
+            pending.assign(detail::workload_magic, sizeof(detail::workload_magic));
+            detail::write_varint(pending, static_cast<std::uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::system_clock::now().time_since_epoch()).count()));
+        };
+
+        workload_trace_writer() = delete;        //!<  Delete default constructor.
+        ~workload_trace_writer() { flush(); };   //!<  Writes any buffered events.
+
+        workload_trace_writer(const workload_trace_writer&) = delete;
+        workload_trace_writer& operator=(const workload_trace_writer&) = delete;
+
+        /*!
+         * \brief Record the start of a hash.
+         * \return Session id to pass to md5_update() and md5_finalize().
+         */
+        std::uint64_t md5_begin(void) {
+            std::lock_guard<std::mutex> lock(trace_mtx);
+            const std::uint64_t session = next_session++;
+            begin_event(trace_op::md5_begin);
+            detail::write_varint(pending, session);
+            end_event();
+            return session;
+        };
+
+        /*!
+         * \brief Record an update.
+         * \param session Session from md5_begin().
+         * \param bytes Bytes passed to update.
+         */
+        void md5_update(const std::uint64_t& session, const std::size_t& bytes) {
+            std::lock_guard<std::mutex> lock(trace_mtx);
+            begin_event(trace_op::md5_update);
+            detail::write_varint(pending, session);
+            detail::write_varint(pending, bytes);
+            end_event();
+        };
+
+        /*!
+         * \brief Record the end of a hash.
+         * \param session Session from md5_begin().
+         */
+        void md5_finalize(const std::uint64_t& session) {
+            std::lock_guard<std::mutex> lock(trace_mtx);
+            begin_event(trace_op::md5_finalize);
+            detail::write_varint(pending, session);
+            end_event();
+        };
+
+        /*!
+         * \brief Record a terrain request.
+         * \tparam T Height map type - float, double or long double.
+         * \param factor Factor the map is built with.
+         * \param offset Offset the map is built with.
+         * \param seed Seed the map is built with.
+         */
+        template <typename T>
+        void terrain(const std::size_t& factor, const T& offset, const std::uint32_t& seed) {
+            const trace_precision precision =
+                std::is_same_v<T, float> ? trace_precision::float_map :
+                std::is_same_v<T, long double> ? trace_precision::long_double_map : trace_precision::double_map;
+            std::lock_guard<std::mutex> lock(trace_mtx);
+            begin_event(trace_op::terrain);
+            detail::write_varint(pending, static_cast<std::uint64_t>(precision));
+            detail::write_varint(pending, factor);
+            detail::write_varint(pending, seed);
+            detail::write_varint(pending, detail::double_bits(static_cast<double>(offset)));
+            end_event();
+        }
+
+        /*!
+         * \brief Write buffered events to the file.
+         */
+        void flush(void) {
+            std::lock_guard<std::mutex> lock(trace_mtx);
+            write_pending();
+        };
+
+    private:
+        //  Called with the lock held.
+        void begin_event(const trace_op& op) {
+            const auto now = std::chrono::steady_clock::now();
+            const auto gap = std::chrono::duration_cast<std::chrono::nanoseconds>(now - last).count();
+            last = now;
+            detail::write_varint(pending, static_cast<std::uint64_t>(op));
+            detail::write_varint(pending, static_cast<std::uint64_t>(gap < 0 ? 0 : gap));
+        };
+
+        void end_event(void) { if(pending.size() >= block_size) write_pending(); };
+
+        void write_pending(void) {
+            if(pending.empty()) return;
+            file.write(pending.data(), pending.size());
+            file.flush();
+            pending.clear();
+        };
+
+        static constexpr std::size_t block_size = 64 * 1024;  //  Buffered bytes before writing
+
+        std::ofstream file;                           //  Trace file
+        std::string pending;                          //  Events not yet written
+        std::chrono::steady_clock::time_point last;   //  Time of the previous event
+        std::uint64_t next_session = 0;               //  Next md5 session id
+        std::mutex trace_mtx;                         //  Guards the members above
+};
+
+/*!
+ * \class traced_md5_hasher
+ * \brief md5_hasher that records its calls to a workload trace.
+ * Each update() locks the writer, see workload_trace_writer.
+ */
+class traced_md5_hasher {
+    public:
+        /*!
+         * \brief Create a hasher recording to a trace.
+         * \param writer Trace to record to.  Must outlive the hasher.
+         */
+        explicit traced_md5_hasher(workload_trace_writer& writer) : trace(writer) {};
+
+        traced_md5_hasher() = delete;        //!<  Delete default constructor.
+        ~traced_md5_hasher() = default;      //!<  Default destructor.
+
+        /*!
+         * \brief Start a hash.  See md5_hasher::initialize().
+         */
+        void initialize(void) {
+            session = trace.md5_begin();
+            hasher.initialize();
+        };
+
+        /*!
+         * \brief Hash a block of data.  See md5_hasher::update().
+         * \param hash_me Data to hash
+         * \param len Length of data buffer
+         */
+        void update(const unsigned char* hash_me, std::size_t len) {
+            trace.md5_update(session, len);
+            hasher.update(hash_me, len);
+        };
+
+        /*!
+         * \brief Finish the hash.  See md5_hasher::finalize().
+         */
+        void finalize(void) {
+            trace.md5_finalize(session);
+            hasher.finalize();
+        };
+
+        /*!
+         * \brief Return the calculated hash as a string
+         * \return MD5 hash value
+         */
+        const std::string get_hash(void) { return hasher.get_hash(); };
+
+    private:
+        workload_trace_writer& trace;  //  Trace to record to
+        md5_hasher hasher;             //  Hasher doing the work
+        std::uint64_t session = 0;     //  Session id of the current hash
+};
+
+/*!
+ * \brief Read a workload trace.
+ * A truncated final event is ignored.
+ * \param path File to read.
+ * \return Events in recorded order.
+ * \throws std::runtime_error if the file can not be opened or is not a workload trace.
+ */
+inline std::vector<trace_event> read_workload_trace(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    if(!in.is_open()) throw std::runtime_error("Unable to open workload trace:  " + path);
+    char magic[sizeof(detail::workload_magic)];
+    std::uint64_t start = 0;
+    if(!in.read(magic, sizeof(magic)) ||
+       std::memcmp(magic, detail::workload_magic, sizeof(magic)) != 0 ||
+       !detail::read_varint(in, start))
+        throw std::runtime_error("Not a workload trace:  " + path);
+
+    std::vector<trace_event> res;
+    std::int64_t at_ns = 0;
+    std::uint64_t op = 0, gap = 0;
+    while(detail::read_varint(in, op)) {
+        if(!detail::read_varint(in, gap)) break;
+        trace_event ev;
+        ev.op = static_cast<trace_op>(op);
+        at_ns += static_cast<std::int64_t>(gap);
+        ev.at_ns = at_ns;
+        bool complete = true;
+        std::uint64_t precision = 0, factor = 0, seed = 0, bits = 0;
+        switch(ev.op) {
+            case trace_op::md5_begin:
+            case trace_op::md5_finalize:
+                complete = detail::read_varint(in, ev.session);
+                break;
+            case trace_op::md5_update:
+                complete = detail::read_varint(in, ev.session) && detail::read_varint(in, ev.bytes);
+                break;
+            case trace_op::terrain:
+                complete = detail::read_varint(in, precision) && detail::read_varint(in, factor) &&
+                    detail::read_varint(in, seed) && detail::read_varint(in, bits);
+                ev.precision = static_cast<trace_precision>(precision);
+                ev.factor = static_cast<std::size_t>(factor);
+                ev.seed = static_cast<std::uint32_t>(seed);
+                ev.offset = detail::bits_double(bits);
+                break;
+            default:
+                throw std::runtime_error("Corrupt workload trace:  " + path);
+        }
+        if(!complete) break;
+        res.push_back(ev);
+    }
+    return res;
+};
+
+/*!
+ * \struct replay_options
+ * \brief Settings for replay_trace().
+ */
+struct replay_options {
+    bool recorded_pace = false;   //!<  Wait between events as recorded, instead of running flat out.
+    double speed = 1.0;           //!<  Pace multiplier when recorded_pace is set, eg 2 for twice as fast.
+    bool record_latency = true;   //!<  Time each operation into the latency_recorder.
+};
+
+/*!
+ * \struct replay_result
+ * \brief Work done by replay_trace().
+ */
+struct replay_result {
+    std::uint64_t events = 0;    //!<  Events replayed.
+    std::uint64_t hashes = 0;    //!<  Hashes finalized.
+    std::uint64_t bytes = 0;     //!<  Bytes hashed.
+    std::uint64_t terrains = 0;  //!<  Height maps built.
+    std::chrono::nanoseconds elapsed {0};  //!<  Wall time of the replay.
+};
+
+namespace detail {
+
+template <typename T>
+inline void replay_terrain(const trace_event& ev) {
+    //  diamond_square keeps a reference to the offset, so it must outlive the map.
+    const T offset = static_cast<T>(ev.offset);
+    diamond_square<T> map(ev.factor, offset, ev.seed);
+    map.build_map();
+    do_not_optimize(map[0]);
+};
+
+}  //  end namespace detail
+
+/*!
+ * \brief Replay a workload trace as a benchmark.
+ * Logged under the label with the bytes hashed and events replayed.
+ * \param label Benchmark label.
+ * \param events Events from read_workload_trace().
+ * \param opts Pace and latency settings.
+ * \return Work done and time taken.
+ */
+inline replay_result replay_trace(
+    const std::string& label,
+    const std::vector<trace_event>& events,
+    const replay_options& opts = replay_options()
+) {
+    using clock = std::chrono::steady_clock;
+    std::size_t largest = 0;
+    for(auto& ev : events) if(ev.op == trace_op::md5_update) largest = std::max<std::size_t>(largest, ev.bytes);
+    std::vector<unsigned char> data(largest);
+    for(std::size_t i = 0; i < data.size(); i++) data[i] = static_cast<unsigned char>(i * 131 + 7);
+
+    latency_recorder::series& update_series = latency_recorder::instance().get(label + "/md5 update");
+    latency_recorder::series& finalize_series = latency_recorder::instance().get(label + "/md5 finalize");
+    latency_recorder::series& terrain_series = latency_recorder::instance().get(label + "/terrain");
+    std::map<std::uint64_t, md5_hasher> sessions;
+    replay_result res;
+    const double speed = opts.speed > 0.0 ? opts.speed : 1.0;
+    constexpr auto spin_below = std::chrono::microseconds(50);
+
+    benchmark<> bench(label);
+    bench.start();
+    const clock::time_point start = clock::now();
+    for(auto& ev : events) {
+        if(opts.recorded_pace) {
+            const clock::time_point due = start +
+                std::chrono::nanoseconds(static_cast<std::int64_t>(static_cast<double>(ev.at_ns) / speed));
+            if(due - clock::now() > spin_below) std::this_thread::sleep_until(due - spin_below);
+            while(clock::now() < due) {}
+        }
+        const clock::time_point op_start = opts.record_latency ? clock::now() : clock::time_point();
+        latency_recorder::series* series = nullptr;
+        switch(ev.op) {
+            case trace_op::md5_begin:
+                sessions[ev.session].initialize();
+                break;
+            case trace_op::md5_update:
+                sessions[ev.session].update(data.data(), static_cast<std::size_t>(ev.bytes));
+                res.bytes += ev.bytes;
+                series = &update_series;
+                break;
+            case trace_op::md5_finalize: {
+                auto it = sessions.find(ev.session);
+                if(it == sessions.end()) break;
+                it->second.finalize();
+                do_not_optimize(it->second);
+                sessions.erase(it);
+                res.hashes++;
+                series = &finalize_series;
+                break;
+            }
+            case trace_op::terrain:
+                if(ev.precision == trace_precision::float_map) detail::replay_terrain<float>(ev);
+                else if(ev.precision == trace_precision::long_double_map) detail::replay_terrain<long double>(ev);
+                else detail::replay_terrain<double>(ev);
+                res.terrains++;
+                series = &terrain_series;
+                break;
+        }
+        if(opts.record_latency && series != nullptr) {
+            const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - op_start).count();
+            series->record(static_cast<std::uint64_t>(ns));
+        }
+        res.events++;
+    }
+    res.elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start);
+    bench.set_bytes(res.bytes);
+    bench.set_items(res.events);
+    bench.stop();
+    return res;
+};
+
+}  //  end namespace wtf
+
+#endif